@@ -10,11 +10,42 @@
 #include <fcntl.h>
 #include <algorithm>
 #include <cstring>
+#include <cerrno>
+#include <cstdint>
 #include <dirent.h>
+#include <ftw.h>
 #include <regex>
 #include <map>
+#include <set>
+#include <deque>
 #include <libgen.h>
 #include <limits.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <spawn.h>
+#include <dlfcn.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <sched.h>
+#include <memory>
+#include <array>
+#include <cmath>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -24,9 +55,20 @@ enum JudgeResult {
     WA,      // 答案错误
     TLE,     // 超时
     MLE,     // 内存超限
+    OLE,     // 输出超限
     RE,      // 运行时错误
     UKE,     // 未知错误
-    CE       // 编译错误
+    CE,      // 编译错误
+    SKIPPED  // 同一子任务中已有测试点失败，未运行
+};
+
+// 内置比较器 (env中的"比较方式")，在评测进程内直接比较，不需要编译和启动checker
+enum Comparator {
+    TEXT_COMPARE,       // 文本：逐行比较，忽略行尾空白 (默认)
+    TOKEN_COMPARE,      // 单词：按空白分隔的单词逐个比较
+    FLOAT_COMPARE,      // 实数：单词中的实数按误差比较，其余单词逐字比较
+    CASE_FOLD_COMPARE,  // 忽略大小写：同单词，但不区分ASCII字母的大小写 (如YES/yes)
+    LINE_SET_COMPARE    // 行集合：行的顺序无关 (可重集合)，忽略行尾空白和末尾的空行
 };
 
 // 配置结构体
@@ -38,18 +80,175 @@ struct Config {
     bool communication = false;     // 是否为通信题
     int time_limit = 1000;          // 时间限制(ms)
     int memory_limit = 512;         // 内存限制(MB)
+    int wall_time_limit = 0;        // 墙钟时间限制(ms)，0表示CPU时间限制的2倍
+    int process_limit = 64;         // 进程数限制 (仅cgroup后端生效)
+    int output_limit = 256;         // 输出大小限制(MB)
+    int communication_processes = 2;  // 通信题中学生程序的实例数
+    Comparator comparator = TEXT_COMPARE;  // 内置比较器，不是文本比较时不使用checker
+    bool checker_plugin = false;    // checker.cpp编译为共享库，在评测进程内调用
+    bool checker_isolation = false; // 每次检查在单独的辅助进程中加载并调用checker插件，插件崩溃不影响评测进程
+    int checker_workers = 0;        // 常驻checker进程数，0表示每个测试点启动一次checker
+    bool result_cache = false;      // 缓存学生程序的运行结果，重测时输入和程序都没变的测试点不再运行
+    double absolute_error = 1e-6;   // 实数比较允许的绝对误差
+    double relative_error = 1e-6;   // 实数比较允许的相对误差
     vector<int> point_ratio;        // 每个测试点的分数比例
     vector<int> subtask_groups;     // 子任务分组
 };
 
+// 默认的编译缓存目录：$XDG_CACHE_HOME/judge，未设置时为/tmp/judge_cache-<uid>
+// 缓存中的可执行文件会被直接运行，不能放在其他用户可以预先创建的固定路径下
+string default_cache_dir() {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg != nullptr && xdg[0] == '/') {
+        return string(xdg) + "/judge";
+    }
+    return "/tmp/judge_cache-" + to_string(geteuid());
+}
+
+// 命令行选项
+struct Options {
+    int jobs = 1;                   // 并行评测的测试点数 (-j N, N<=0 表示按CPU核数)
+    string cgroup_dir;              // 委派给评测机的cgroup v2目录 (--cgroup DIR)，为空时使用rlimit
+    bool stream = false;            // 流式比对 (--stream)，第一处不一致立即判WA
+    string cache_dir = default_cache_dir();  // 编译缓存目录 (--cache-dir DIR，为空时不缓存)
+    long long cache_size_mb = 1024;          // 编译缓存容量上限(MB)，超出后按LRU淘汰
+    string serve_socket;            // 常驻模式监听的Unix socket (--serve PATH)
+    string work_root = "/tmp";      // 临时工作目录的父目录 (--work-dir DIR，--tmpfs 使用/dev/shm)
+    bool pin_cpu = false;           // 交互题把学生程序和交互器绑定到同一个CPU (--pin-cpu)
+    bool zygote = false;            // 静态链接学生程序并预先启动启动器 (--zygote)
+    bool static_link = false;       // 学生程序静态链接 (--static，--zygote时总是静态链接)
+    long long input_cache_mb = 0;   // 输入文件缓存的内存预算(MB，--input-cache MB)，0表示不缓存
+};
+
+// 单次运行的资源限制
+struct RunLimits {
+    int time_limit;                 // CPU时间限制(ms)
+    int wall_time_limit;            // 墙钟时间限制(ms)
+    int memory_limit;               // 内存限制(MB)
+    int process_limit;              // 进程数限制
+    string cgroup_dir;              // cgroup v2父目录，为空时使用rlimit
+    int cpu = -1;                   // 绑定的CPU编号，-1表示不绑定
+    int output_limit = 0;           // 写入文件的大小限制(MB，RLIMIT_FSIZE)，0表示不限制
+};
+
+// 只读映射整个文件，空文件映射为空缓冲区
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() {
+        if (mapping != nullptr) {
+            munmap(mapping, length);
+        }
+    }
+    
+    bool open(const string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        bool mapped = map(fd);
+        close(fd);
+        return mapped;
+    }
+    
+    // 映射已打开的文件 (如捕获输出的memfd)，fd仍由调用者持有
+    bool map(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+        length = st.st_size;
+        if (length > 0) {
+            void *addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                length = 0;
+                return false;
+            }
+            mapping = addr;
+            madvise(mapping, length, MADV_SEQUENTIAL);
+        }
+        return true;
+    }
+    
+    const char *data() const {
+        return mapping != nullptr ? (const char *)mapping : "";
+    }
+    
+    size_t size() const {
+        return length;
+    }
+    
+private:
+    void *mapping = nullptr;
+    size_t length = 0;
+};
+
+// 文本比对第一处不同的位置 (line为0表示没有记录)
+struct CompareDiff {
+    long line = 0;                  // 行号，从1开始
+    long column = 0;                // 列号 (字节)，从1开始
+    long long offset = 0;           // 在用户输出中的字节偏移
+};
+
+// 任务包 (judge pack 生成)：env、测试点索引和全部测试数据放在一个文件中，整体只读映射
+// 布局为 PackHeader | PackEntry[point_count] | env原文 | 各测试点的输入和标准输出，整数按本机字节序
+const char PACK_MAGIC[8] = {'J', 'U', 'D', 'G', 'E', 'P', 'K', '\0'};
+const uint32_t PACK_VERSION = 1;
+
+struct PackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t point_count;
+    uint64_t index_offset;          // PackEntry数组的偏移
+    uint64_t env_offset;
+    uint64_t env_size;
+    uint64_t reserved[3];
+};
+
+struct PackEntry {
+    int32_t number;                 // 测试点编号 (打包时文件名中的数字)
+    uint32_t reserved;
+    uint64_t input_offset;
+    uint64_t input_size;
+    uint64_t output_offset;
+    uint64_t output_size;
+    unsigned char input_hash[32];   // SHA-256
+    unsigned char output_hash[32];
+};
+
+static_assert(sizeof(PackHeader) == 64 && sizeof(PackEntry) == 104, "任务包格式的结构体大小不能改变");
+
+struct TaskPack {
+    string path;
+    MappedFile file;
+    
+    const PackHeader &header() const {
+        return *(const PackHeader *)file.data();
+    }
+    
+    const PackEntry *entries() const {
+        return (const PackEntry *)(file.data() + header().index_offset);
+    }
+};
+
 // 测试点信息
 struct TestPoint {
-    string input_file;
+    string input_file;              // 来自任务包时只用于显示，数据在pack_entry指向的位置
     string output_file;
+    int number;                     // 测试点编号 (文件名中的数字)
     int point_ratio;
     JudgeResult result;
     double time_used;
+    double wall_time_used;
     long memory_used;
+    int subtask;                    // 所属子任务编号，0表示不属于任何子任务
+    CompareDiff diff;
+    shared_ptr<MappedFile> answer;  // 常驻模式下缓存的标准输出映射，为空时按路径打开
+    shared_ptr<TaskPack> pack;      // 所属的任务包，为空表示数据是普通文件
+    const PackEntry *pack_entry = nullptr;
+    bool cached_run = false;        // 运行结果取自结果缓存，没有运行学生程序
 };
 
 // 工具函数：分割字符串
@@ -77,10 +276,102 @@ string get_executable_dir() {
     return ".";
 }
 
-// 读取配置文件
-Config read_config(const string &config_file) {
+// 递归删除目录 (不跟随符号链接，子目录先于父目录删除)
+int remove_tree_entry(const char *path, const struct stat *, int, struct FTW *) {
+    remove(path);
+    return 0;
+}
+
+void remove_tree(const string &path) {
+    nftw(path.c_str(), remove_tree_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// 尚未删除的工作目录，收到SIGINT/SIGTERM时清理
+// 信号处理函数只把信号编号写入管道，由清理线程删除目录后以原信号结束进程
+set<string> active_work_dirs;
+mutex work_dirs_mutex;
+int cleanup_pipe[2] = {-1, -1};
+
+void cleanup_work_dirs_on_signal(int sig) {
+    unsigned char byte = sig;
+    ssize_t written = write(cleanup_pipe[1], &byte, 1);
+    (void)written;
+}
+
+void cleanup_work_dirs_thread() {
+    unsigned char sig;
+    ssize_t n;
+    while ((n = read(cleanup_pipe[0], &sig, 1)) < 0 && errno == EINTR) {}
+    if (n != 1) {
+        return;
+    }
+    lock_guard<mutex> lock(work_dirs_mutex);
+    for (const auto &dir : active_work_dirs) {
+        remove_tree(dir);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// 私有的临时工作目录，析构时连同其中的文件一起删除
+// 每次评测 (以及其中每个工作线程) 使用自己的目录，同一台机器上的多个评测互不干扰
+class WorkDir {
+public:
+    WorkDir(const WorkDir &) = delete;
+    WorkDir &operator=(const WorkDir &) = delete;
+    
+    explicit WorkDir(const string &root) {
+        string pattern = root + "/judge-XXXXXX";
+        vector<char> buffer(pattern.begin(), pattern.end());
+        buffer.push_back('\0');
+        if (mkdtemp(buffer.data()) != nullptr) {
+            // 使用绝对路径，子进程切换到工作目录后程序路径仍然有效
+            char *resolved = realpath(buffer.data(), nullptr);
+            dir = (resolved != nullptr) ? resolved : buffer.data();
+            free(resolved);
+            chmod(dir.c_str(), 0755);  // 子进程可能以其他用户运行
+            track(true);
+        }
+    }
+    
+    ~WorkDir() {
+        if (!dir.empty()) {
+            remove_tree(dir);
+            track(false);
+        }
+    }
+    
+    bool valid() const {
+        return !dir.empty();
+    }
+    
+    const string &path() const {
+        return dir;
+    }
+    
+private:
+    void track(bool add) {
+        static bool handlers_installed = false;
+        lock_guard<mutex> lock(work_dirs_mutex);
+        if (!handlers_installed && pipe2(cleanup_pipe, O_CLOEXEC) == 0) {
+            thread(cleanup_work_dirs_thread).detach();
+            signal(SIGINT, cleanup_work_dirs_on_signal);
+            signal(SIGTERM, cleanup_work_dirs_on_signal);
+            handlers_installed = true;
+        }
+        if (add) {
+            active_work_dirs.insert(dir);
+        } else {
+            active_work_dirs.erase(dir);
+        }
+    }
+    
+    string dir;
+};
+
+// 解析配置 (env文件或任务包中保存的env)
+Config parse_config(istream &file, ostream &err) {
     Config config;
-    ifstream file(config_file);
     string line;
     
     while (getline(file, line)) {
@@ -116,13 +407,61 @@ Config read_config(const string &config_file) {
             config.time_limit = stoi(value);
         } else if (key == "内存限制(MB)") {
             config.memory_limit = stoi(value);
+        } else if (key == "墙钟时间限制(ms)") {
+            config.wall_time_limit = stoi(value);
+        } else if (key == "进程数限制") {
+            config.process_limit = stoi(value);
+        } else if (key == "输出限制(MB)") {
+            config.output_limit = stoi(value);
+        } else if (key == "通信题进程数") {
+            config.communication_processes = stoi(value);
+        } else if (key == "比较方式") {
+            static const map<string, Comparator> comparators = {
+                {"文本", TEXT_COMPARE}, {"单词", TOKEN_COMPARE}, {"实数", FLOAT_COMPARE},
+                {"忽略大小写", CASE_FOLD_COMPARE}, {"行集合", LINE_SET_COMPARE}};
+            auto it = comparators.find(value);
+            if (it != comparators.end()) {
+                config.comparator = it->second;
+            } else {
+                err << "警告: 未知的比较方式 " << value << "，使用文本比较" << endl;
+            }
+        } else if (key == "是否为checker插件") {
+            config.checker_plugin = (value == "1" || value == "true");
+        } else if (key == "checker插件隔离") {
+            config.checker_isolation = (value == "1" || value == "true");
+        } else if (key == "checker常驻进程数") {
+            config.checker_workers = stoi(value);
+        } else if (key == "结果缓存") {
+            config.result_cache = (value == "1" || value == "true");
+        } else if (key == "绝对误差") {
+            config.absolute_error = stod(value);
+        } else if (key == "相对误差") {
+            config.relative_error = stod(value);
         }
     }
     
-    file.close();
+    if (config.wall_time_limit <= 0) {
+        config.wall_time_limit = config.time_limit * 2;
+    }
+    // checker插件是Special Judge的一种运行方式
+    if (config.checker_plugin) {
+        config.special_judge = true;
+    }
+    // 明确指定的checker优先于内置比较器
+    if (config.comparator != TEXT_COMPARE && config.special_judge && !config.interactive && !config.communication) {
+        err << "警告: 同时指定了比较方式和Special Judge，使用checker评测，忽略比较方式" << endl;
+        config.comparator = TEXT_COMPARE;
+    }
+    
     return config;
 }
 
+// 读取配置文件
+Config read_config(const string &config_file, ostream &err) {
+    ifstream file(config_file);
+    return parse_config(file, err);
+}
+
 // 从文件名中提取数字
 int extract_number_from_filename(const string &filename) {
     // 使用正则表达式匹配文件名中的数字
@@ -137,14 +476,14 @@ int extract_number_from_filename(const string &filename) {
 }
 
 // 获取测试点列表
-vector<TestPoint> get_test_points(const string &task_dir, const vector<int> &ratios) {
+vector<TestPoint> get_test_points(const string &task_dir, const vector<int> &ratios, ostream &err) {
     vector<TestPoint> test_points;
     map<int, pair<string, string>> file_map;  // 使用map按数字排序
     
     // 读取目录中的所有文件
     DIR *dir = opendir(task_dir.c_str());
     if (dir == nullptr) {
-        cerr << "无法打开目录: " << task_dir << endl;
+        err << "无法打开目录: " << task_dir << endl;
         return test_points;
     }
     
@@ -185,7 +524,7 @@ vector<TestPoint> get_test_points(const string &task_dir, const vector<int> &rat
     
     closedir(dir);
     
-    // 创建测试点列表（按数字排序）
+    // 创建测试点列表（map已按数字排序）
     int index = 0;
     for (const auto &entry : file_map) {
         int num = entry.first;
@@ -196,303 +535,4993 @@ vector<TestPoint> get_test_points(const string &task_dir, const vector<int> &rat
             TestPoint point;
             point.input_file = files.first;
             point.output_file = files.second;
+            point.number = num;
             point.point_ratio = (index < ratios.size()) ? ratios[index] : 1;
             point.result = UKE;
             point.time_used = 0;
+            point.wall_time_used = 0;
             point.memory_used = 0;
+            point.subtask = 0;
             
             test_points.push_back(point);
             index++;
         } else {
-            cerr << "警告: 测试点" << num << "缺少输入或输出文件" << endl;
+            err << "警告: 测试点" << num << "缺少输入或输出文件" << endl;
         }
     }
     
-    // 按数字排序
-    sort(test_points.begin(), test_points.end(),
-         [](const TestPoint &a, const TestPoint &b) {
-             int num_a = extract_number_from_filename(a.input_file);
-             int num_b = extract_number_from_filename(b.input_file);
-             return num_a < num_b;
-         });
-    
     return test_points;
 }
 
-// 编译C++代码
-bool compile_cpp(const string &source_file, const string &executable, bool use_testlib = false) {
-    string exe_dir = get_executable_dir();
-    string command;
+// SHA-256，用于编译缓存的内容寻址
+class Sha256 {
+public:
+    Sha256() {
+        static const uint32_t init[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(state, init, sizeof(state));
+    }
     
-    if (use_testlib) {
-        // 包含testlib.h路径
-        command = "g++ -std=c++11 -O2 -I" + exe_dir + " -o " + executable + " " + source_file + " 2> /tmp/compile_error.txt";
-    } else {
-        command = "g++ -std=c++11 -O2 -o " + executable + " " + source_file + " 2> /tmp/compile_error.txt";
+    void update(const void *data, size_t size) {
+        const unsigned char *p = (const unsigned char *)data;
+        total += size;
+        while (size > 0) {
+            size_t n = min(size, (size_t)64 - buffered);
+            memcpy(buffer + buffered, p, n);
+            buffered += n;
+            p += n;
+            size -= n;
+            if (buffered == 64) {
+                transform(buffer);
+                buffered = 0;
+            }
+        }
     }
     
-    int ret = system(command.c_str());
+    void update(const string &data) {
+        update(data.data(), data.size());
+    }
     
-    if (ret != 0) {
-        cout << "编译错误: " << source_file << endl;
-        ifstream error_file("/tmp/compile_error.txt");
-        if (error_file.is_open()) {
-            string line;
-            while (getline(error_file, line)) {
-                cout << line << endl;
-            }
-            error_file.close();
+    // 结束计算，返回64位十六进制串
+    string hex_digest() {
+        unsigned char bytes[32];
+        digest(bytes);
+        static const char digits[] = "0123456789abcdef";
+        string hex;
+        for (unsigned char byte : bytes) {
+            hex += digits[byte >> 4];
+            hex += digits[byte & 0xF];
         }
+        return hex;
+    }
+    
+    // 结束计算，写出32字节的摘要
+    void digest(unsigned char bytes[32]) {
+        uint64_t bits = total * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (buffered != 56) {
+            update(&pad, 1);
+        }
+        unsigned char length[8];
+        for (int i = 0; i < 8; i++) {
+            length[i] = (unsigned char)(bits >> (56 - 8 * i));
+        }
+        update(length, 8);
+        for (int i = 0; i < 32; i++) {
+            bytes[i] = (unsigned char)(state[i / 4] >> (24 - 8 * (i % 4)));
+        }
+    }
+    
+private:
+    static uint32_t rotr(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+    
+    void transform(const unsigned char *block) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+                   (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+    
+    uint32_t state[8];
+    unsigned char buffer[64];
+    size_t buffered = 0;
+    uint64_t total = 0;
+};
+
+// 把文件内容加入哈希，文件不存在返回false
+bool hash_file(Sha256 &hash, const string &path) {
+    MappedFile file;
+    if (!file.open(path)) {
         return false;
     }
+    hash.update(file.data(), file.size());
     return true;
 }
 
-// 运行程序并收集资源使用情况
-JudgeResult run_program(const string &program, const string &input_file, 
-                       const string &output_file, int time_limit, 
-                       int memory_limit, double &time_used, long &memory_used) {
-    pid_t pid = fork();
-    
-    if (pid == 0) {
-        // 子进程
-        // 设置资源限制
-        rlimit rl;
-        rl.rlim_cur = (time_limit / 1000.0) + 1;  // 秒
-        rl.rlim_max = rl.rlim_cur;
-        setrlimit(RLIMIT_CPU, &rl);
-        
-        rl.rlim_cur = memory_limit * 1024 * 1024;  // 转换为字节
-        rl.rlim_max = rl.rlim_cur;
-        setrlimit(RLIMIT_AS, &rl);
-        
-        // 重定向输入输出
-        freopen(input_file.c_str(), "r", stdin);
-        freopen(output_file.c_str(), "w", stdout);
-        freopen("/tmp/program_stderr.txt", "w", stderr);
-        
-        execl(program.c_str(), program.c_str(), NULL);
-        exit(EXIT_FAILURE);
-    } else if (pid > 0) {
-        // 父进程
-        int status;
-        struct rusage usage;
-        wait4(pid, &status, 0, &usage);
-        
-        // 获取时间和内存使用
-        time_used = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
-                   (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
-        memory_used = usage.ru_maxrss;  // KB
-        
-        // 检查结果
-        if (WIFEXITED(status)) {
-            if (WEXITSTATUS(status) == 0) {
-                // 检查时间和内存限制
-                if (time_used > time_limit) {
-                    return TLE;
-                }
-                if (memory_used > memory_limit * 1024) {  // 转换为KB
-                    return MLE;
-                }
-                return AC;
-            } else {
-                return RE;
-            }
-        } else if (WIFSIGNALED(status)) {
-            int sig = WTERMSIG(status);
-            if (sig == SIGXCPU || sig == SIGALRM) {
-                return TLE;
-            } else if (sig == SIGSEGV || sig == SIGABRT) {
-                return RE;
-            }
+// 映射并检查任务包，失败时返回空指针并在error中说明原因
+// 只检查文件头和索引 (O(测试点数))，不读取测试数据，也不校验哈希
+shared_ptr<TaskPack> load_pack(const string &path, string &error) {
+    shared_ptr<TaskPack> pack = make_shared<TaskPack>();
+    pack->path = path;
+    if (!pack->file.open(path)) {
+        error = string("无法打开任务包: ") + strerror(errno);
+        return nullptr;
+    }
+    uint64_t size = pack->file.size();
+    const PackHeader &header = pack->header();
+    if (size < sizeof(PackHeader) || memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0) {
+        error = "不是任务包文件";
+        return nullptr;
+    }
+    if (header.version != PACK_VERSION) {
+        error = "任务包版本不受支持: " + to_string(header.version);
+        return nullptr;
+    }
+    if (header.index_offset % alignof(PackEntry) != 0 || header.index_offset > size ||
+        (size - header.index_offset) / sizeof(PackEntry) < header.point_count ||
+        header.env_offset > size || size - header.env_offset < header.env_size) {
+        error = "任务包索引损坏";
+        return nullptr;
+    }
+    const PackEntry *entries = pack->entries();
+    for (uint32_t i = 0; i < header.point_count; i++) {
+        const PackEntry &entry = entries[i];
+        if (entry.input_offset > size || size - entry.input_offset < entry.input_size ||
+            entry.output_offset > size || size - entry.output_offset < entry.output_size) {
+            error = "任务包中测试点" + to_string(entry.number) + "的数据超出文件范围";
+            return nullptr;
         }
-        return UKE;
     }
-    return UKE;
+    return pack;
 }
 
-// 普通评测：比较输出文件
-JudgeResult normal_judge(const string &std_output, const string &user_output) {
-    ifstream std_file(std_output);
-    ifstream user_file(user_output);
-    
-    if (!std_file.is_open() || !user_file.is_open()) {
-        return UKE;
+// 任务包中保存的env
+Config pack_config(const TaskPack &pack, ostream &err) {
+    const PackHeader &header = pack.header();
+    istringstream env(string(pack.file.data() + header.env_offset, header.env_size));
+    return parse_config(env, err);
+}
+
+// 任务包中的测试点列表，顺序与打包时相同 (按编号排序)
+vector<TestPoint> pack_test_points(const shared_ptr<TaskPack> &pack, const vector<int> &ratios) {
+    vector<TestPoint> test_points(pack->header().point_count);
+    const PackEntry *entries = pack->entries();
+    for (size_t i = 0; i < test_points.size(); i++) {
+        TestPoint &point = test_points[i];
+        string name = pack->path + ":" + to_string(entries[i].number);
+        point.input_file = name + ".in";
+        point.output_file = name + ".out";
+        point.number = entries[i].number;
+        point.point_ratio = (i < ratios.size()) ? ratios[i] : 1;
+        point.result = UKE;
+        point.time_used = 0;
+        point.wall_time_used = 0;
+        point.memory_used = 0;
+        point.subtask = 0;
+        point.pack = pack;
+        point.pack_entry = &entries[i];
     }
-    
-    string std_line, user_line;
-    while (getline(std_file, std_line)) {
-        if (!getline(user_file, user_line)) {
-            return WA;
+    return test_points;
+}
+
+// 编译器版本信息 (g++ -v的完整输出，包括配置参数)，只查询一次
+const string &compiler_version() {
+    static const string version = []() {
+        string output;
+        FILE *pipe = popen("g++ -v 2>&1", "r");
+        if (pipe != nullptr) {
+            char buffer[4096];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+                output.append(buffer, n);
+            }
+            pclose(pipe);
         }
-        
-        // 去除行尾空格
-        std_line.erase(std_line.find_last_not_of(" \t\n\r\f\v") + 1);
-        user_line.erase(user_line.find_last_not_of(" \t\n\r\f\v") + 1);
-        
-        if (std_line != user_line) {
-            return WA;
+        return output;
+    }();
+    return version;
+}
+
+// 评测机自身可执行文件的SHA-256，评测机更新后结果缓存全部失效
+const string &judge_version() {
+    static const string version = []() {
+        Sha256 hash;
+        return hash_file(hash, "/proc/self/exe") ? hash.hex_digest() : string();
+    }();
+    return version;
+}
+
+// 复制文件并设置权限
+bool copy_file(const string &from, const string &to, mode_t mode) {
+    int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+    int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+    char buffer[65536];
+    ssize_t n;
+    bool ok = true;
+    while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+        if (write(out, buffer, n) != n) {
+            ok = false;
+            break;
         }
     }
-    
-    // 检查用户输出是否有多余行
-    if (getline(user_file, user_line)) {
-        user_line.erase(user_line.find_last_not_of(" \t\n\r\f\v") + 1);
-        if (!user_line.empty()) {
-            return WA;
+    ok = ok && n == 0;
+    close(in);
+    close(out);
+    return ok;
+}
+
+// 创建并检查编译缓存目录，不安全时关闭缓存
+// 目录必须是当前有效用户所有、组和其他用户不可写的真实目录 (不跟随符号链接)，
+// 否则其他用户可以在内容哈希对应的位置放入伪造的学生程序或checker
+void prepare_cache_dir(Options &options, ostream &err) {
+    if (options.cache_dir.empty()) {
+        return;
+    }
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg != nullptr && options.cache_dir == default_cache_dir()) {
+        mkdir(xdg, 0700);
+    }
+    mkdir(options.cache_dir.c_str(), 0700);
+    struct stat st;
+    const char *problem = nullptr;
+    if (lstat(options.cache_dir.c_str(), &st) != 0) {
+        problem = strerror(errno);
+    } else if (!S_ISDIR(st.st_mode)) {
+        problem = "不是目录";
+    } else if (st.st_uid != geteuid()) {
+        problem = "不属于当前用户";
+    } else if (st.st_mode & (S_IWGRP | S_IWOTH)) {
+        problem = "组或其他用户可写";
+    }
+    if (problem != nullptr) {
+        err << "警告: 编译缓存目录 " << options.cache_dir << " 不可用 (" << problem << ")，不使用缓存" << endl;
+        options.cache_dir.clear();
+    }
+}
+
+// 从编译缓存取出可执行文件：优先硬链接，跨文件系统时复制；命中时刷新mtime作为LRU时间
+bool compile_cache_fetch(const string &entry, const string &executable) {
+    if (utimensat(AT_FDCWD, entry.c_str(), nullptr, 0) != 0) {
+        return false;  // 未命中或已被淘汰
+    }
+    remove(executable.c_str());
+    return link(entry.c_str(), executable.c_str()) == 0 || copy_file(entry, executable, 0755);
+}
+
+// 把编译结果放入缓存：先写临时文件再rename，多个评测机并发写入同一项也是安全的
+void compile_cache_store(const string &cache_dir, const string &entry, const string &executable) {
+    static atomic<unsigned long> counter(0);
+    string temp = cache_dir + "/.tmp-" + to_string(getpid()) + "-" + to_string(counter++);
+    if (!copy_file(executable, temp, 0755) || rename(temp.c_str(), entry.c_str()) != 0) {
+        remove(temp.c_str());
+    }
+}
+
+// 把一段数据写入缓存项，与compile_cache_store一样先写临时文件再rename
+void cache_store_data(const string &cache_dir, const string &entry, const char *data, size_t size) {
+    static atomic<unsigned long> counter(0);
+    string temp = cache_dir + "/.tmp-data-" + to_string(getpid()) + "-" + to_string(counter++);
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    bool ok = true;
+    while (size > 0 && ok) {
+        ssize_t n = write(fd, data, size);
+        ok = n > 0;
+        if (ok) {
+            data += n;
+            size -= n;
         }
     }
-    
-    return AC;
+    close(fd);
+    if (!ok || rename(temp.c_str(), entry.c_str()) != 0) {
+        remove(temp.c_str());
+    }
 }
 
-// Special Judge评测 (使用testlib.h的checker)
-JudgeResult special_judge(const string &spj_program, const string &input_file,
-                         const string &std_output, const string &user_output) {
-    // testlib格式的checker通常接受三个参数：输入文件、用户输出、标准输出
-    // 或者四个参数：输入文件、用户输出、标准输出、结果文件
-    // 我们使用三个参数的格式
-    string command = spj_program + " " + input_file + " " + user_output + " " + std_output + " 2> /tmp/spj_error.txt";
-    
-    int ret = system(command.c_str());
+// 缓存总大小超过上限时按mtime从旧到新淘汰，用flock与其他评测机互斥
+void compile_cache_evict(const string &cache_dir, long long max_bytes) {
+    int lock_fd = open((cache_dir + "/.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) {
+        return;
+    }
+    flock(lock_fd, LOCK_EX);
     
-    if (WIFEXITED(ret)) {
-        int exit_code = WEXITSTATUS(ret);
-        if (exit_code == 0) {
-            return AC;
-        } else if (exit_code == 1 || exit_code == 2) {
-            return WA;
-        } else {
-            // 读取可能的错误信息
-            ifstream error_file("/tmp/spj_error.txt");
-            if (error_file.is_open()) {
-                string line;
-                while (getline(error_file, line)) {
-                    cerr << "SPJ错误: " << line << endl;
-                }
-                error_file.close();
+    vector<pair<timespec, pair<string, long long>>> entries;
+    long long total = 0;
+    DIR *dir = opendir(cache_dir.c_str());
+    if (dir != nullptr) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (entry->d_name[0] == '.') continue;  // 跳过锁文件和写入中的临时文件
+            string path = cache_dir + "/" + entry->d_name;
+            struct stat st;
+            if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                entries.push_back(make_pair(st.st_mtim, make_pair(path, (long long)st.st_size)));
+                total += st.st_size;
             }
-            return UKE;
+        }
+        closedir(dir);
+    }
+    sort(entries.begin(), entries.end(), [](const decltype(entries)::value_type &a,
+                                             const decltype(entries)::value_type &b) {
+        if (a.first.tv_sec != b.first.tv_sec) return a.first.tv_sec < b.first.tv_sec;
+        return a.first.tv_nsec < b.first.tv_nsec;
+    });
+    for (size_t i = 0; i < entries.size() && total > max_bytes; i++) {
+        if (remove(entries[i].second.first.c_str()) == 0) {
+            total -= entries[i].second.second;
         }
     }
     
-    return UKE;
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
 }
 
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        cerr << "用法: " << argv[0] << " student.cpp task_folder" << endl;
-        cerr << "示例: " << argv[0] << " solution.cpp ./testdata" << endl;
-        return 1;
-    }
-    
-    string student_cpp = argv[1];
-    string task_dir = argv[2];
-    
-    // 读取配置文件
-    string config_file = task_dir + "/env";
-    Config config = read_config(config_file);
-    
-    // 编译学生代码
-    if (!compile_cpp(student_cpp, "/tmp/student")) {
-        cout << "学生代码编译失败" << endl;
-        cout << "总分: 0" << endl;
-        return 0;
+// 后台编译任务
+struct CompileJob {
+    string source_file;
+    string executable;
+    string error_file;              // 编译器诊断输出，每个任务单独一个文件
+    string cache_entry;             // 编译成功后写入的缓存项，为空表示不缓存
+    pid_t pid = -1;                 // g++进程 (同时是进程组长)，-1表示未启动
+    bool cached = false;            // 命中编译缓存，无需等待
+    string pch_error;               // testlib.h预编译头生成失败时g++的诊断信息 (编译照常进行)
+};
+
+// 启动g++ (不经过shell)，标准错误写入error_file；g++在单独的进程组中，取消时连同cc1plus/as/ld一起杀死
+pid_t start_compiler(vector<string> args, const string &error_file) {
+    vector<char *> argv;
+    for (auto &arg : args) {
+        argv.push_back(&arg[0]);
     }
+    argv.push_back(nullptr);
     
-    // 如果需要，编译Special Judge代码 (使用checker.cpp和testlib.h)
-    if (config.special_judge) {
-        string checker_cpp = task_dir + "/checker.cpp";
-        if (!compile_cpp(checker_cpp, "/tmp/checker", true)) {
-            cerr << "Special Judge代码 (checker.cpp) 编译失败" << endl;
-            return 1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        int err_fd = open(error_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (err_fd >= 0) {
+            dup2(err_fd, STDERR_FILENO);
+            close(err_fd);
         }
+        execvp(argv[0], argv.data());
+        _exit(127);
     }
-    
-    // 获取测试点
-    vector<TestPoint> test_points = get_test_points(task_dir, config.point_ratio);
-    
-    if (test_points.empty()) {
-        cerr << "未找到测试点" << endl;
-        cerr << "请确保测试文件夹中包含格式为 *.in 和 *.out 的文件，且文件名中包含数字（如 game001.in, game001.out）" << endl;
-        return 1;
+    if (pid > 0) {
+        setpgid(pid, pid);  // 与子进程中的调用重复，避免取消时子进程还没来得及设置
     }
+    return pid;
+}
+
+// 读出整个文本文件，打不开时返回空串
+string read_text_file(const string &path) {
+    ifstream file(path);
+    ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+// 确保可执行文件目录下的testlib.h有对应的预编译头testlib.h.gch
+// testlib.h.gch.stamp记录 testlib.h内容 + 编译参数 + 编译器版本 的哈希，任何一项变化都会重新生成；
+// g++在-I目录中找到与参数匹配的.gch时会直接使用它而不再解析testlib.h
+// 生成失败时返回false并在error中给出g++的诊断信息，调用者照常编译 (直接解析testlib.h)
+bool ensure_testlib_pch(const string &exe_dir, const vector<string> &flags, string &error) {
+    string header = exe_dir + "/testlib.h";
+    string pch = header + ".gch";
+    string stamp_file = pch + ".stamp";
     
-    // 运行所有测试点
-    double total_score = 0;
-    int total_ratio = 0;
-    for (auto &ratio : config.point_ratio) {
-        total_ratio += ratio;
+    Sha256 hash;
+    if (!hash_file(hash, header)) {
+        return true;  // 没有testlib.h，编译时由g++报告
     }
-    if (total_ratio == 0) total_ratio = test_points.size();
+    for (const auto &flag : flags) {
+        hash.update(flag + '\0');
+    }
+    hash.update(compiler_version());
+    string stamp = hash.hex_digest();
     
-    cout << "开始评测..." << endl;
-    cout << "测试点数量: " << test_points.size() << endl;
-    cout << "时间限制: " << config.time_limit << "ms" << endl;
-    cout << "内存限制: " << config.memory_limit << "MB" << endl;
-    if (config.special_judge) {
-        cout << "评测方式: Special Judge (使用testlib.h)" << endl;
-    } else {
-        cout << "评测方式: 文本比对" << endl;
+    auto up_to_date = [&]() {
+        ifstream file(stamp_file);
+        string recorded;
+        struct stat st;
+        return (file >> recorded) && recorded == stamp && stat(pch.c_str(), &st) == 0;
+    };
+    if (up_to_date()) {
+        return true;
     }
-    cout << endl;
     
-    for (size_t i = 0; i < test_points.size(); i++) {
-        TestPoint &point = test_points[i];
-        
-        // 从文件名中提取测试点编号
-        int point_num = extract_number_from_filename(point.input_file);
-        string point_name = (point_num != -1) ? to_string(point_num) : to_string(i + 1);
-        
-        // 运行学生程序
-        string student_output = "/tmp/student_out_" + to_string(i + 1) + ".txt";
-        point.result = run_program("/tmp/student", point.input_file, 
-                                 student_output, config.time_limit,
-                                 config.memory_limit, point.time_used, point.memory_used);
-        
-        // 如果运行成功，进行评测
-        if (point.result == AC) {
-            if (config.special_judge) {
-                point.result = special_judge("/tmp/checker", point.input_file,
-                                           point.output_file, student_output);
-            } else {
-                point.result = normal_judge(point.output_file, student_output);
-            }
+    // 多个评测机同时发现过期时只由一个重新生成
+    int lock_fd = open((pch + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) {
+        return true;  // 目录不可写，退回到直接解析testlib.h
+    }
+    flock(lock_fd, LOCK_EX);
+    bool ok = true;
+    if (!up_to_date()) {
+        string temp = pch + ".tmp-" + to_string(getpid());
+        string error_file = temp + ".err";
+        vector<string> args = flags;
+        args.insert(args.end(), {"-x", "c++-header", header, "-o", temp});
+        pid_t pid = start_compiler(args, error_file);
+        int status = -1;
+        while (pid > 0 && waitpid(pid, &status, 0) < 0 && errno == EINTR) {
         }
-        
-        // 输出测试点结果
-        string result_str;
-        switch (point.result) {
-            case AC: result_str = "AC"; break;
-            case WA: result_str = "WA"; break;
-            case TLE: result_str = "TLE"; break;
-            case MLE: result_str = "MLE"; break;
-            case RE: result_str = "RE"; break;
-            case UKE: result_str = "UKE"; break;
-            default: result_str = "UKE";
+        ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && rename(temp.c_str(), pch.c_str()) == 0;
+        if (!ok) {
+            error = read_text_file(error_file);
         }
-        
-        cout << "测试点 " << point_name << ": " << result_str;
-        if (point.result == AC) {
-            cout << " (" << point.time_used << "ms, " 
-                 << point.memory_used << "KB)";
-            total_score += config.total_score * point.point_ratio / (double)total_ratio;
+        remove(error_file.c_str());
+        if (ok) {
+            ofstream out(stamp_file + ".tmp");
+            out << stamp << endl;
+            out.close();
+            rename((stamp_file + ".tmp").c_str(), stamp_file.c_str());
+        } else {
+            // 过期的.gch会被g++直接使用，生成失败时删掉它
+            remove(temp.c_str());
+            remove(pch.c_str());
+            remove(stamp_file.c_str());
         }
-        cout << endl;
-        
-        // 清理临时文件
-        remove(student_output.c_str());
-    }
-    
-    cout << endl;
-    cout << "评测结束" << endl;
-    cout << "总分: " << (int)total_score << "/" << config.total_score << endl;
-    
-    // 清理可执行文件
-    remove("/tmp/student");
-    if (config.special_judge) {
-        remove("/tmp/checker");
     }
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    return ok;
+}
+
+// 常驻checker进程的外壳，与checker.cpp一起编译，checker源码不需要修改
+// 链接时用 -Wl,--wrap=main 让启动代码进入外壳的__wrap_main，checker的main仍按main编译
+// (末尾没有return时返回0)，外壳通过__real_main调用它
+// 外壳从标准输入上的socket接收 输入、选手输出、标准输出、错误输出 四个fd，每个测试点fork一个子进程，
+// 子进程以 /proc/self/fd/N 的路径调用checker的main后正常exit (testlib的quitf同样经过exit)，
+// 外壳把它的退出码 (被信号杀死时为3) 写回socket；评测机关闭socket时退出
+// 子进程都从外壳的初始状态开始，checker的全局变量 (testlib的inf/ouf/ans等)、打开的文件和stdio缓冲
+// 不会带到下一个测试点；省下的是每个测试点的exec、动态链接和重定位
+const char *CHECKER_WORKER_SOURCE = R"(#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+extern "C" int __real_main(int argc, char *argv[]);
+
+extern "C" int __wrap_main(int argc, char *argv[]) {
+    (void)argc;
+    int socket_fd = fcntl(0, F_DUPFD_CLOEXEC, 3);
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (socket_fd < 0 || null_fd < 0) return 127;
+    dup2(null_fd, 0);
+    for (;;) {
+        int fds[4];
+        char control[CMSG_SPACE(sizeof(fds))];
+        char byte;
+        struct iovec iov = {&byte, 1};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC) <= 0) _exit(0);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == 0 || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) _exit(0);
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        pid_t pid = fork();
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            close(socket_fd);
+            // 与单独运行的checker相同的CPU时间限制
+            struct rlimit rl = {11, 11};
+            setrlimit(RLIMIT_CPU, &rl);
+            char paths[3][32];
+            for (int i = 0; i < 3; i++) snprintf(paths[i], sizeof(paths[i]), "/proc/self/fd/%d", fds[i]);
+            char *args[] = {argv[0], paths[0], paths[1], paths[2], 0};
+            dup2(fds[3], 1);
+            dup2(fds[3], 2);
+            exit(__real_main(4, args));
+        }
+        for (int i = 0; i < 4; i++) close(fds[i]);
+        int status, code = 3;
+        if (pid > 0) {
+            while (waitpid(pid, &status, 0) < 0) {
+                if (errno != EINTR) _exit(0);
+            }
+            if (WIFEXITED(status)) code = WEXITSTATUS(status);
+        }
+        if (write(socket_fd, &code, sizeof(code)) != sizeof(code)) _exit(0);
+    }
+}
+)";
+
+// 开始编译C++代码，不等待结束
+// 开启编译缓存时以 源码 + 编译参数 + 编译器版本 (+ testlib.h) 的SHA-256为键，
+// 命中时直接取出可执行文件，不调用g++；未命中的checker编译使用testlib.h的预编译头
+// shared_object为true时编译为共享库 (checker插件)，checker_worker为true时加上常驻checker的外壳
+CompileJob start_compile(const string &source_file, const string &executable, const Options &options,
+                         bool use_testlib = false, bool shared_object = false, bool checker_worker = false) {
+    CompileJob job;
+    job.source_file = source_file;
+    job.executable = executable;
+    job.error_file = executable + "_compile_error.txt";
+    
+    string exe_dir = get_executable_dir();
+    vector<string> args = {"g++", "-std=c++11", "-O2"};
+    vector<string> pch_flags = args;  // 预编译头必须用相同的标准和优化参数生成
+    if (shared_object) {
+        args.push_back("-shared");
+        args.push_back("-fPIC");
+    } else if (use_testlib) {
+        // 包含testlib.h路径
+        args.push_back("-I" + exe_dir);
+        if (checker_worker) {
+            args.push_back("-Wl,--wrap=main");
+        }
+    } else if (options.static_link || options.zygote) {
+        // 学生程序静态链接，exec后不需要动态加载和重定位
+        args.push_back("-static");
+    }
+    
+    if (!options.cache_dir.empty()) {
+        Sha256 hash;
+        for (const auto &arg : args) {
+            hash.update(arg + '\0');
+        }
+        hash.update(compiler_version() + '\0');
+        bool readable = hash_file(hash, source_file);
+        if (use_testlib) {
+            hash.update("\0testlib.h\0", 11);
+            hash_file(hash, exe_dir + "/testlib.h");
+        }
+        if (checker_worker) {
+            hash.update(CHECKER_WORKER_SOURCE);
+        }
+        if (readable) {
+            job.cache_entry = options.cache_dir + "/" + hash.hex_digest();
+            if (compile_cache_fetch(job.cache_entry, executable)) {
+                job.cached = true;
+                return job;
+            }
+        }
+    }
+    
+    if (use_testlib && !ensure_testlib_pch(exe_dir, pch_flags, job.pch_error) && job.pch_error.empty()) {
+        job.pch_error = "g++ 没有输出诊断信息";
+    }
+    
+    args.push_back("-o");
+    args.push_back(executable);
+    args.push_back(source_file);
+    if (checker_worker) {
+        string shell_source = executable + "_worker.cpp";
+        ofstream file(shell_source);
+        file << CHECKER_WORKER_SOURCE;
+        args.push_back(shell_source);
+    }
+    job.pid = start_compiler(args, job.error_file);
+    return job;
+}
+
+// 等待编译结束，失败时把编译器诊断信息输出到out
+bool finish_compile(CompileJob &job, const Options &options, ostream &out) {
+    if (job.cached) {
+        return true;
+    }
+    if (!job.pch_error.empty()) {
+        out << "警告: testlib.h预编译头生成失败，直接解析testlib.h" << endl;
+        out << job.pch_error;
+        if (job.pch_error.back() != '\n') out << endl;
+    }
+    int status = -1;
+    if (job.pid > 0) {
+        while (waitpid(job.pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        job.pid = -1;
+    }
+    
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        out << "编译错误: " << job.source_file << endl;
+        ifstream error_file(job.error_file);
+        if (error_file.is_open()) {
+            string line;
+            while (getline(error_file, line)) {
+                out << line << endl;
+            }
+            error_file.close();
+        }
+        remove(job.error_file.c_str());
+        return false;
+    }
+    remove(job.error_file.c_str());
+    
+    if (!job.cache_entry.empty()) {
+        compile_cache_store(options.cache_dir, job.cache_entry, job.executable);
+        compile_cache_evict(options.cache_dir, options.cache_size_mb * 1024 * 1024);
+    }
+    return true;
+}
+
+// 取消尚未结束的编译
+void cancel_compile(CompileJob &job) {
+    if (job.pid > 0) {
+        kill(-job.pid, SIGKILL);
+        while (waitpid(job.pid, nullptr, 0) < 0 && errno == EINTR) {
+        }
+        job.pid = -1;
+    }
+    remove(job.error_file.c_str());
+}
+
+// pidfd相关系统调用 (旧版glibc没有包装函数)
+int pidfd_open_compat(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int pidfd_send_signal_compat(int pidfd, int sig) {
+#ifdef SYS_pidfd_send_signal
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// 从start开始经过的毫秒数 (CLOCK_MONOTONIC)
+double elapsed_ms(const timespec &start) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+// 设置一次性timerfd，ms毫秒后触发
+void arm_timer(int timer_fd, double ms) {
+    if (ms < 1) ms = 1;
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)(ms / 1000);
+    spec.it_value.tv_nsec = (long)((ms - spec.it_value.tv_sec * 1000.0) * 1000000);
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+}
+
+// 读取文件的第一个整数，失败返回-1
+long long read_file_value(const string &path) {
+    ifstream file(path);
+    long long value;
+    if (file >> value) {
+        return value;
+    }
+    return -1;
+}
+
+// 读取cpu.stat、memory.events这类"键 值"格式文件中的一项，失败返回-1
+long long read_file_key(const string &path, const string &key) {
+    ifstream file(path);
+    string name;
+    long long value;
+    while (file >> name >> value) {
+        if (name == key) {
+            return value;
+        }
+    }
+    return -1;
+}
+
+// 写入cgroup控制文件
+bool write_file(const string &path, const string &value) {
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, value.c_str(), value.size()) == (ssize_t)value.size();
+    close(fd);
+    return ok;
+}
+
+// 检查cgroup v2目录是否可用，并为子cgroup打开memory/pids/cpu控制器
+bool cgroup_prepare(const string &cgroup_dir) {
+    ifstream controllers(cgroup_dir + "/cgroup.controllers");
+    string line;
+    if (!controllers.is_open() || !getline(controllers, line)) {
+        return false;  // 不是cgroup v2目录
+    }
+    vector<string> available = split(line, ' ');
+    for (const char *name : {"memory", "pids"}) {
+        if (find(available.begin(), available.end(), name) == available.end()) {
+            return false;
+        }
+    }
+    // 已经打开时写入不会出错；父cgroup中还有进程时会失败 (no internal processes规则)
+    write_file(cgroup_dir + "/cgroup.subtree_control", "+memory +pids");
+    write_file(cgroup_dir + "/cgroup.subtree_control", "+cpu");
+    
+    ifstream subtree(cgroup_dir + "/cgroup.subtree_control");
+    string enabled;
+    getline(subtree, enabled);
+    vector<string> enabled_list = split(enabled, ' ');
+    return find(enabled_list.begin(), enabled_list.end(), "memory") != enabled_list.end() &&
+           find(enabled_list.begin(), enabled_list.end(), "pids") != enabled_list.end();
+}
+
+// 为一次运行创建独立的叶子cgroup并写入限制，失败返回空串
+string cgroup_create(const RunLimits &limits) {
+    static atomic<unsigned long> counter(0);
+    string path = limits.cgroup_dir + "/judge-" + to_string(getpid()) + "-" + to_string(counter++);
+    if (mkdir(path.c_str(), 0755) != 0) {
+        return "";
+    }
+    long long memory_bytes = (long long)limits.memory_limit * 1024 * 1024;
+    if (!write_file(path + "/memory.max", to_string(memory_bytes)) ||
+        !write_file(path + "/pids.max", to_string(limits.process_limit))) {
+        rmdir(path.c_str());
+        return "";
+    }
+    write_file(path + "/memory.swap.max", "0");   // 没有swap控制器时忽略
+    write_file(path + "/memory.oom.group", "1");  // 超限时杀死整个cgroup而不是其中一个进程
+    return path;
+}
+
+// 杀死cgroup中剩余的进程并删除它
+void cgroup_destroy(const string &path) {
+    if (!write_file(path + "/cgroup.kill", "1")) {
+        // 5.14之前的内核没有cgroup.kill，逐个杀死
+        ifstream procs(path + "/cgroup.procs");
+        pid_t pid;
+        while (procs >> pid) {
+            kill(pid, SIGKILL);
+        }
+    }
+    // 进程退出需要一点时间，cgroup非空时rmdir返回EBUSY
+    for (int i = 0; i < 1000; i++) {
+        if (rmdir(path.c_str()) == 0 || errno != EBUSY) {
+            break;
+        }
+        usleep(1000);
+    }
+}
+
+// 读取已用CPU时间(ms)：有cgroup时读取cpu.stat (包括所有子进程)，否则读取进程CPU时钟
+double read_cpu_ms(const string &cgroup_path, bool has_cpu_clock, clockid_t cpu_clock) {
+    if (!cgroup_path.empty()) {
+        long long usage_usec = read_file_key(cgroup_path + "/cpu.stat", "usage_usec");
+        return usage_usec < 0 ? -1 : usage_usec / 1000.0;
+    }
+    timespec cpu;
+    if (!has_cpu_clock || clock_gettime(cpu_clock, &cpu) != 0) {
+        return -1;  // 子进程正在退出
+    }
+    return cpu.tv_sec * 1000.0 + cpu.tv_nsec / 1000000.0;
+}
+
+// 流式比对：学生程序运行时逐字节比较其标准输出，规则与normal_judge完全相同
+// (逐行比较，忽略行尾空白，标准输出结束后用户输出最多允许再有一个空白行)
+// 标准答案按需逐行读取，用户输出不落盘也不缓存
+class StreamComparator {
+public:
+    bool open(const string &std_output) {
+        std_file.open(std_output);
+        return std_file.is_open();
+    }
+    
+    // 送入一段用户输出，发现不一致时返回false
+    bool feed(const char *data, size_t size) {
+        for (size_t i = 0; i < size && !failed && !done; i++) {
+            char c = data[i];
+            if (!in_line) {
+                begin_line();
+            }
+            if (c == '\n') {
+                end_line();
+            } else if (column < expected.size()) {
+                check(c == expected[column]);
+                column++;
+            } else {
+                // 超出标准行的部分只能是行尾空白
+                check(is_trailing_space(c));
+                column++;
+            }
+            if (!failed) {
+                offset++;
+            }
+        }
+        return !failed;
+    }
+    
+    // 用户输出结束，给出最终结果
+    JudgeResult finish() {
+        if (!failed && !done) {
+            if (in_line) {
+                end_line();  // 最后一行没有换行符
+            }
+            if (!failed && !std_exhausted && getline(std_file, expected)) {
+                line++;
+                column = 0;
+                check(false);  // 用户输出行数不足
+            }
+        }
+        return failed ? WA : AC;
+    }
+    
+    bool mismatched() const {
+        return failed;
+    }
+    
+    const CompareDiff &difference() const {
+        return diff;
+    }
+    
+private:
+    static bool is_trailing_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+    }
+    
+    void check(bool ok) {
+        if (!ok && !failed) {
+            failed = true;
+            diff.line = line;
+            diff.column = column + 1;
+            diff.offset = offset;
+        }
+    }
+    
+    void begin_line() {
+        in_line = true;
+        column = 0;
+        line++;
+        if (std_exhausted || !getline(std_file, expected)) {
+            // 标准输出已结束，这一行多余的输出只能是空白
+            std_exhausted = true;
+            expected.clear();
+        } else {
+            expected.erase(expected.find_last_not_of(" \t\n\r\f\v") + 1);
+        }
+    }
+    
+    void end_line() {
+        in_line = false;
+        if (column < expected.size()) {
+            check(false);
+        } else if (std_exhausted) {
+            done = true;  // 与normal_judge一致，多余的第一行之后不再检查
+        }
+    }
+    
+    ifstream std_file;
+    string expected;             // 当前标准行 (已去除行尾空白)
+    size_t column = 0;           // 当前用户行已比较的字节数
+    bool in_line = false;
+    bool std_exhausted = false;
+    bool failed = false;
+    bool done = false;
+    long line = 0;               // 当前用户行号
+    long long offset = 0;        // 已比较的用户输出字节数
+    CompareDiff diff;
+};
+
+// 读取管道中当前可读的全部数据交给比对器，对端关闭时返回false
+bool pump_output(int pipe_fd, StreamComparator *comparator) {
+    char buffer[65536];
+    while (true) {
+        ssize_t n = read(pipe_fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            comparator->feed(buffer, n);
+        } else if (n == 0) {
+            return false;
+        } else {
+            return errno == EINTR || errno == EAGAIN;
+        }
+    }
+}
+
+// 已启动的被评测进程
+struct ChildProcess {
+    pid_t pid = -1;
+    string cgroup_path;             // 独立的叶子cgroup，为空时使用rlimit
+    timespec start_time;
+    int status = 0;                 // wait4得到的退出状态
+    double base_cpu_ms = 0;         // 交给学生程序之前已用掉的CPU时间 (zygote启动器)，不计入用时
+    struct SupervisedRun *watch = nullptr;  // 监视器中的记录，watch_program之后到回收为止有效
+};
+
+// 监视器中的一次运行，由Supervisor::begin创建、Supervisor::end销毁
+// 从注册到回收只有监视线程访问，之后由等待的线程在锁保护下读取结果
+struct SupervisedRun {
+    pid_t pid;
+    string cgroup_path;
+    timespec start_time;
+    double base_cpu_ms;
+    RunLimits limits;
+    int pidfd = -1;
+    int wall_timer = -1;
+    int cpu_timer = -1;
+    int output_pipe = -1;           // 调用者持有，由等待的线程读取
+    StreamComparator *comparator = nullptr;
+    int output_pidfd = -1;          // 等待的线程转发输出时用来得知子进程退出、杀死子进程
+    bool has_cpu_clock = false;
+    clockid_t cpu_clock;
+    JudgeResult verdict = AC;       // 自行退出为AC，超时被杀死时为TLE
+    bool reaped = false;            // 监视线程已回收
+    bool done = false;              // 结果已交给等待的线程
+    int status = 0;                 // wait4格式的退出状态
+    struct rusage usage;
+    double wall_ms = 0;             // 从启动到回收的墙钟时间
+    condition_variable finished;
+};
+
+// 子进程监视器：一个线程用epoll同时监视所有运行中的子进程，不需要每个子进程占用一个线程等待
+// 每个子进程在epoll上挂pidfd、墙钟定时器和CPU定时器，超过CPU时间或墙钟时间限制时杀死它并判TLE；
+// 子进程退出后用waitid(P_PIDFD)回收并记录rusage，再唤醒等待它的线程
+// 睡眠、阻塞在输入上或死锁的程序不消耗CPU，RLIMIT_CPU对它们无效，只能靠墙钟计时
+// 监视线程只做不阻塞的工作：流式比对要逐字节比较、读标准输出文件或解压管道，
+// 由等待的线程自己转发输出，发现答案错误时杀死子进程并判WA
+// 内核不支持pidfd时由等待的线程转发输出后阻塞在wait4上 (只有RLIMIT_CPU兜底)
+class Supervisor {
+public:
+    // 整个评测进程 (包括常驻模式的所有连接) 共用一个监视线程，进程退出前不销毁
+    static Supervisor &instance() {
+        static Supervisor *supervisor = new Supervisor();
+        return *supervisor;
+    }
+    
+    // 开始监视child，output_pipe不为-1时由end把其中的输出交给comparator
+    SupervisedRun *begin(const ChildProcess &child, const RunLimits &limits,
+                         int output_pipe, StreamComparator *comparator) {
+        SupervisedRun *run = new SupervisedRun();
+        run->pid = child.pid;
+        run->cgroup_path = child.cgroup_path;
+        run->start_time = child.start_time;
+        run->base_cpu_ms = child.base_cpu_ms;
+        run->limits = limits;
+        run->output_pipe = output_pipe;
+        run->comparator = comparator;
+        // 子进程要等加入epoll之后才会被回收，这时打开的pidfd一定指向它
+        if (output_pipe >= 0) {
+            run->output_pidfd = pidfd_open_compat(child.pid);
+        }
+        run->pidfd = (epoll_fd >= 0) ? pidfd_open_compat(child.pid) : -1;
+        if (run->pidfd < 0) {
+            return run;
+        }
+        run->has_cpu_clock = (clock_getcpuclockid(child.pid, &run->cpu_clock) == 0);
+        
+        run->wall_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        // 墙钟时间从进程启动算起 (交互题先启动的进程已经运行了一段时间)
+        arm_timer(run->wall_timer, limits.wall_time_limit - elapsed_ms(run->start_time));
+        if (run->has_cpu_clock || !run->cgroup_path.empty()) {
+            // CPU时间增长不会快于墙钟时间 (单线程)，所以先等time_limit再查询实际CPU用量
+            run->cpu_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+            arm_timer(run->cpu_timer, limits.time_limit);
+        }
+        watch_fd(run, run->wall_timer, WALL_TIMER);
+        watch_fd(run, run->cpu_timer, CPU_TIMER);
+        // pidfd最后加入：一旦可读监视线程就可能回收这个运行
+        watch_fd(run, run->pidfd, PROCESS);
+        return run;
+    }
+    
+    // 等待运行结束并销毁记录，返回AC (自行退出)、TLE或WA，填写退出状态、rusage和墙钟时间
+    JudgeResult end(SupervisedRun *run, int &status, struct rusage &usage, double &wall_ms) {
+        bool stopped = (run->output_pipe >= 0) && compare_output(run);
+        if (run->pidfd < 0) {
+            // 没有pidfd：阻塞在wait4上
+            wait4(run->pid, &run->status, 0, &run->usage);
+            run->wall_ms = elapsed_ms(run->start_time);
+        } else {
+            unique_lock<mutex> guard(lock);
+            run->finished.wait(guard, [run]() { return run->done; });
+        }
+        JudgeResult verdict = run->verdict;
+        // 比对发现不一致后杀死的进程可能同时超时，以先发现的答案错误为准
+        if (run->comparator != nullptr && run->comparator->mismatched() && (verdict == AC || stopped)) {
+            verdict = WA;
+        }
+        status = run->status;
+        usage = run->usage;
+        wall_ms = run->wall_ms;
+        delete run;
+        return verdict;
+    }
+    
+private:
+    enum FdKind { PROCESS = 0, WALL_TIMER = 1, CPU_TIMER = 2 };
+    
+    // 在等待的线程中把输出交给比对器，发现不一致时杀死子进程并返回true
+    // 子进程退出后取走管道中剩余的输出就结束，不等待可能仍持有管道的孙进程
+    static bool compare_output(SupervisedRun *run) {
+        pollfd fds[2] = {{run->output_pipe, POLLIN, 0}, {run->output_pidfd, POLLIN, 0}};
+        bool stopped = false;
+        bool exited = false;
+        while (true) {
+            bool open = pump_output(run->output_pipe, run->comparator);
+            if (run->comparator->mismatched()) {
+                // 没有pidfd时子进程由本线程回收，pid不会被复用
+                if (pidfd_send_signal_compat(run->output_pidfd, SIGKILL) != 0) {
+                    kill(run->pid, SIGKILL);
+                }
+                stopped = true;
+                break;
+            }
+            if (!open || exited) {
+                break;
+            }
+            if (poll(fds, run->output_pidfd >= 0 ? 2 : 1, -1) < 0 && errno != EINTR) {
+                break;
+            }
+            exited = (fds[1].revents & POLLIN) != 0;
+        }
+        if (run->output_pidfd >= 0) {
+            close(run->output_pidfd);
+            run->output_pidfd = -1;
+        }
+        return stopped;
+    }
+    
+    Supervisor() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd >= 0) {
+            thread(&Supervisor::loop, this).detach();
+        }
+    }
+    
+    // epoll的data保存运行记录的指针，低两位是fd的种类
+    void watch_fd(SupervisedRun *run, int fd, FdKind kind) {
+        if (fd < 0) return;
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = (uint64_t)(uintptr_t)run | kind;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+    
+    void unwatch_fd(int &fd, bool owned) {
+        if (fd < 0) return;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        if (owned) close(fd);
+        fd = -1;
+    }
+    
+    void kill_run(SupervisedRun *run, JudgeResult verdict) {
+        run->verdict = verdict;
+        if (pidfd_send_signal_compat(run->pidfd, SIGKILL) != 0) {
+            kill(run->pid, SIGKILL);
+        }
+    }
+    
+    // 子进程已退出：回收并记录rusage
+    void reap(SupervisedRun *run) {
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        const int wait_p_pidfd = 3;  // P_PIDFD，Linux 5.4起支持
+        if (syscall(SYS_waitid, wait_p_pidfd, run->pidfd, &info, WEXITED, &run->usage) == 0) {
+            if (info.si_code == CLD_EXITED) {
+                run->status = (info.si_status & 0xff) << 8;
+            } else {
+                run->status = (info.si_status & 0x7f) | (info.si_code == CLD_DUMPED ? 0x80 : 0);
+            }
+        } else {
+            wait4(run->pid, &run->status, 0, &run->usage);
+        }
+        run->wall_ms = elapsed_ms(run->start_time);
+        run->reaped = true;
+        unwatch_fd(run->wall_timer, true);
+        unwatch_fd(run->cpu_timer, true);
+        unwatch_fd(run->pidfd, true);
+    }
+    
+    void handle(SupervisedRun *run, FdKind kind) {
+        if (kind == PROCESS) {
+            reap(run);
+            return;
+        }
+        int timer = (kind == WALL_TIMER) ? run->wall_timer : run->cpu_timer;
+        uint64_t expirations;
+        ssize_t ignored = read(timer, &expirations, sizeof(expirations));
+        (void)ignored;
+        if (run->verdict != AC) {
+            return;
+        }
+        if (kind == WALL_TIMER) {
+            kill_run(run, TLE);
+            return;
+        }
+        double cpu_ms = read_cpu_ms(run->cgroup_path, run->has_cpu_clock, run->cpu_clock);
+        if (cpu_ms < 0) {
+            return;  // 子进程正在退出
+        }
+        cpu_ms -= run->base_cpu_ms;
+        if (cpu_ms > run->limits.time_limit) {
+            kill_run(run, TLE);
+        } else {
+            arm_timer(run->cpu_timer, run->limits.time_limit - cpu_ms);
+        }
+    }
+    
+    void loop() {
+        const int max_events = 256;
+        epoll_event events[max_events];
+        vector<SupervisedRun *> finished;
+        while (true) {
+            int n = epoll_wait(epoll_fd, events, max_events, -1);
+            if (n < 0) {
+                continue;  // EINTR
+            }
+            for (int i = 0; i < n; i++) {
+                SupervisedRun *run = (SupervisedRun *)(uintptr_t)(events[i].data.u64 & ~(uint64_t)3);
+                if (run->reaped) {
+                    continue;  // 同一批中回收之前的事件
+                }
+                handle(run, (FdKind)(events[i].data.u64 & 3));
+                if (run->reaped) {
+                    finished.push_back(run);
+                }
+            }
+            // 整批处理完再唤醒等待的线程，之后这些记录随时可能被销毁
+            if (!finished.empty()) {
+                lock_guard<mutex> guard(lock);
+                for (SupervisedRun *run : finished) {
+                    run->done = true;
+                    run->finished.notify_one();
+                }
+                finished.clear();
+            }
+        }
+    }
+    
+    int epoll_fd = -1;
+    mutex lock;
+};
+
+// 开始监视已启动的子进程 (交互题等需要同时监视多个进程时先逐个调用)
+void watch_program(ChildProcess &child, const RunLimits &limits, int output_pipe = -1,
+                   StreamComparator *comparator = nullptr) {
+    child.watch = Supervisor::instance().begin(child, limits, output_pipe, comparator);
+}
+
+// 子进程启动参数
+// 子进程是评测进程或启动辅助进程的副本，exec之前只能读取这里的内容、调用系统调用
+struct SpawnArgs {
+    const char *program;
+    char *const *argv;
+    int in_fd, out_fd, err_fd;
+    const RunLimits *limits;
+    int cgroup_procs_fd;
+    const int *inherit_fds;         // 保留给程序的fd
+    const int *inherit_targets;     // 它们在程序中的编号，与inherit_fds相同时原样保留
+    int inherit_count;
+    const char *cwd;                // 为nullptr时不切换工作目录
+    sigset_t mask;                  // exec前恢复的信号掩码
+    int error_pipe;                 // 启动失败时子进程把errno写入这个管道 (close-on-exec)
+};
+
+// 子进程在exec之前失败：把errno交给父进程后退出
+static void spawn_failed(SpawnArgs *args) {
+    int error = errno;
+    ssize_t written = write(args->error_pipe, &error, sizeof(error));
+    (void)written;
+    _exit(127);
+}
+
+// clone出的子进程：设置cgroup、资源限制、文件描述符和工作目录后exec
+static int spawn_child(void *data) {
+    SpawnArgs *args = (SpawnArgs *)data;
+    const RunLimits &limits = *args->limits;
+    
+    // 评测机安装的信号处理函数 (临时目录清理) 和忽略的SIGPIPE都不能留给被评测程序
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    for (int sig = 1; sig < NSIG; sig++) {
+        sigaction(sig, &action, nullptr);
+    }
+    
+    // 评测进程被杀死时子进程随之退出，不会残留在已删除的工作目录里
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    
+    // 加入cgroup (写入0表示当前进程)
+    if (args->cgroup_procs_fd >= 0 && write(args->cgroup_procs_fd, "0", 1) != 1) {
+        spawn_failed(args);
+    }
+    
+    if (limits.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(limits.cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    
+    // 设置资源限制
+    rlimit rl;
+    rl.rlim_cur = (limits.time_limit / 1000.0) + 1;  // 秒
+    rl.rlim_max = rl.rlim_cur;
+    setrlimit(RLIMIT_CPU, &rl);
+    
+    if (args->cgroup_procs_fd < 0) {
+        rl.rlim_cur = (rlim_t)limits.memory_limit * 1024 * 1024;  // 转换为字节
+        rl.rlim_max = rl.rlim_cur;
+        setrlimit(RLIMIT_AS, &rl);
+    }
+    
+    // 输出写入memfd，RLIMIT_FSIZE同样生效，超出时收到SIGXFSZ
+    if (limits.output_limit > 0) {
+        rl.rlim_cur = (rlim_t)limits.output_limit * 1024 * 1024;
+        rl.rlim_max = rl.rlim_cur;
+        setrlimit(RLIMIT_FSIZE, &rl);
+    }
+    
+    // 重定向输入输出 (fd可能互相占用目标位置，先全部复制到3以上，exec时自动关闭)
+    int in_fd = fcntl(args->in_fd, F_DUPFD_CLOEXEC, 3);
+    int out_fd = fcntl(args->out_fd, F_DUPFD_CLOEXEC, 3);
+    int err_fd = fcntl(args->err_fd, F_DUPFD_CLOEXEC, 3);
+    if (in_fd < 0 || out_fd < 0 || err_fd < 0 ||
+        dup2(in_fd, STDIN_FILENO) < 0 || dup2(out_fd, STDOUT_FILENO) < 0 ||
+        dup2(err_fd, STDERR_FILENO) < 0) {
+        spawn_failed(args);
+    }
+    // 编号不同时inherit_fds都在所有目标编号之上，不会被前面的dup2覆盖
+    for (int i = 0; i < args->inherit_count; i++) {
+        int fd = args->inherit_fds[i], target = args->inherit_targets[i];
+        if ((fd == target ? fcntl(fd, F_SETFD, 0) : dup2(fd, target)) < 0) {
+            spawn_failed(args);
+        }
+    }
+    if (args->cwd != nullptr && chdir(args->cwd) != 0) {
+        spawn_failed(args);
+    }
+    
+    sigprocmask(SIG_SETMASK, &args->mask, nullptr);
+    execv(args->program, args->argv);
+    spawn_failed(args);
+    return 127;
+}
+
+// 直接clone出子进程，exec之前失败时error为子进程的errno (子进程已退出，由调用者回收)
+// 使用clone(CLONE_VFORK)：父线程挂起到子进程exec或退出为止
+// 不能共享评测进程的地址空间 (CLONE_VM)：exec时内核把旧地址空间的RSS峰值计入子进程的ru_maxrss，
+// 共享时就是评测进程映射的测试数据和任务包，小程序也会被误判超出内存限制；
+// 复制出的地址空间只含评测进程写过的私有页，文件和memfd的共享映射不复制，但页表复制的开销随评测进程变大
+static pid_t spawn_direct(SpawnArgs &args, int &error) {
+    int error_pipe[2];
+    if (pipe2(error_pipe, O_CLOEXEC) != 0) {
+        error = errno;
+        return -1;
+    }
+    args.error_pipe = error_pipe[1];
+    
+    const size_t stack_size = 64 * 1024;
+    void *stack = mmap(nullptr, stack_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    pid_t pid = -1;
+    error = ENOMEM;
+    if (stack != MAP_FAILED) {
+        // 子进程恢复默认信号处理之前不能运行父进程的信号处理函数
+        sigset_t all;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &args.mask);
+        pid = clone(spawn_child, (char *)stack + stack_size, CLONE_VFORK | SIGCHLD, &args);
+        error = (pid < 0) ? errno : 0;
+        pthread_sigmask(SIG_SETMASK, &args.mask, nullptr);
+        munmap(stack, stack_size);
+    }
+    close(error_pipe[1]);
+    if (pid > 0 && read(error_pipe[0], &error, sizeof(error)) != sizeof(error)) {
+        error = 0;
+    }
+    close(error_pipe[0]);
+    return pid;
+}
+
+// 启动辅助进程的请求：之后是inherit_count个目标fd编号，再是以'\0'结尾的程序路径、工作目录 (为空时不切换)
+// 和argc个命令行参数；标准输入/输出/错误、cgroup.procs (has_cgroup时) 和保留给程序的fd按顺序用SCM_RIGHTS发送
+struct SpawnRequest {
+    int time_limit;
+    int memory_limit;
+    int output_limit;
+    int cpu;
+    int has_cgroup;
+    int inherit_count;
+    int argc;
+};
+
+// 启动辅助进程的回复，与spawn_direct的结果相同
+struct SpawnReply {
+    pid_t pid;
+    int error;
+};
+
+const size_t SPAWN_REQUEST_MAX = 64 * 1024;
+const size_t SPAWN_FDS_MAX = 250;   // SCM_RIGHTS一次最多传253个fd
+
+// 启动辅助进程：评测进程刚启动时fork出的副本，由它clone(CLONE_VM | CLONE_VFORK)出被评测程序
+// 它的地址空间不到2MB，共享给子进程时不用复制页表，exec时计入子进程ru_maxrss的旧RSS峰值也很小；
+// CLONE_PARENT让子进程成为评测进程的子进程，回收、pidfd和PDEATHSIG都与直接启动时相同
+// 辅助进程是单线程的，收到请求后用收到的fd和限制填好SpawnArgs，子进程exec或退出后回复
+int spawn_helper_main(int sock) {
+    vector<char> buffer(SPAWN_REQUEST_MAX);
+    vector<char> control(CMSG_SPACE(sizeof(int) * SPAWN_FDS_MAX));
+    const size_t stack_size = 64 * 1024;
+    void *stack = mmap(nullptr, stack_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        return 1;
+    }
+    while (true) {
+        iovec iov = {buffer.data(), buffer.size()};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;  // 评测进程已退出
+        }
+        vector<int> fds;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                const int *data = (const int *)CMSG_DATA(cmsg);
+                fds.insert(fds.end(), data, data + (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            }
+        }
+        
+        SpawnRequest request;
+        char *p = buffer.data() + sizeof(request), *end = buffer.data() + n;
+        bool valid = (size_t)n >= sizeof(request) && !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC));
+        if (valid) {
+            memcpy(&request, buffer.data(), sizeof(request));
+            valid = request.inherit_count >= 0 && request.argc > 0 &&
+                    fds.size() == 3 + (request.has_cgroup ? 1 : 0) + (size_t)request.inherit_count &&
+                    (size_t)(end - p) >= request.inherit_count * sizeof(int);
+        }
+        vector<int> targets;
+        vector<char *> strings;
+        if (valid) {
+            targets.resize(request.inherit_count);
+            memcpy(targets.data(), p, request.inherit_count * sizeof(int));
+            p += request.inherit_count * sizeof(int);
+            for (char *zero; p < end && (zero = (char *)memchr(p, '\0', end - p)) != nullptr; p = zero + 1) {
+                strings.push_back(p);
+            }
+            valid = p == end && strings.size() == 2 + (size_t)request.argc;
+        }
+        
+        SpawnReply reply = {-1, EINVAL};
+        // 保留给程序的fd和错误管道先移到所有目标编号之上，子进程中的dup2不会覆盖它们
+        int lowest = 3;
+        for (int target : targets) {
+            lowest = max(lowest, target + 1);
+        }
+        auto raise_fd = [lowest](int &fd) {
+            int moved = fcntl(fd, F_DUPFD_CLOEXEC, lowest);
+            close(fd);
+            fd = moved;
+            return moved >= 0;
+        };
+        vector<int> inherit_fds(fds.end() - targets.size(), fds.end());
+        int error_pipe[2] = {-1, -1};
+        for (int &fd : inherit_fds) {
+            valid = raise_fd(fd) && valid;
+        }
+        if (valid && (pipe2(error_pipe, O_CLOEXEC) != 0 || !raise_fd(error_pipe[1]))) {
+            reply.error = errno;
+            valid = false;
+        }
+        if (valid) {
+            RunLimits limits;
+            limits.time_limit = request.time_limit;
+            limits.memory_limit = request.memory_limit;
+            limits.output_limit = request.output_limit;
+            limits.cpu = request.cpu;
+            strings.push_back(nullptr);
+            
+            SpawnArgs args;
+            args.program = strings[0];
+            args.argv = strings.data() + 2;
+            args.in_fd = fds[0];
+            args.out_fd = fds[1];
+            args.err_fd = fds[2];
+            args.limits = &limits;
+            args.cgroup_procs_fd = request.has_cgroup ? fds[3] : -1;
+            args.inherit_fds = inherit_fds.data();
+            args.inherit_targets = targets.data();
+            args.inherit_count = request.inherit_count;
+            args.cwd = (*strings[1] != '\0') ? strings[1] : nullptr;
+            args.error_pipe = error_pipe[1];
+            sigprocmask(SIG_SETMASK, nullptr, &args.mask);
+            // CLONE_PARENT时子进程的退出信号沿用辅助进程的SIGCHLD
+            reply.pid = clone(spawn_child, (char *)stack + stack_size,
+                              CLONE_VM | CLONE_VFORK | CLONE_PARENT, &args);
+            reply.error = (reply.pid < 0) ? errno : 0;
+            close(error_pipe[1]);
+            if (reply.pid > 0 && read(error_pipe[0], &reply.error, sizeof(reply.error)) != sizeof(reply.error)) {
+                reply.error = 0;
+            }
+        }
+        for (int fd : {error_pipe[0], error_pipe[1]}) {
+            if (fd >= 0) close(fd);
+        }
+        for (size_t i = 0; i < fds.size() - inherit_fds.size(); i++) {
+            close(fds[i]);
+        }
+        for (int fd : inherit_fds) {
+            if (fd >= 0) close(fd);
+        }
+        if (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply)) {
+            return 0;
+        }
+    }
+}
+
+// 评测进程到启动辅助进程的连接，所有线程共用，一次处理一个请求
+// 没有启动辅助进程 (打包、基准测试等模式) 或它已退出时spawn返回false，由调用者直接启动
+class SpawnHelper {
+public:
+    static SpawnHelper &instance() {
+        static SpawnHelper *helper = new SpawnHelper();
+        return *helper;
+    }
+    
+    // fork出启动辅助进程，要在映射测试数据、启动其它线程之前调用 (辅助进程是评测进程此时的副本)
+    // 只在主线程调用：被评测程序是辅助进程父线程的子进程，PDEATHSIG跟随这个线程
+    void start() {
+        int sv[2];
+        if (sock >= 0 || socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+            return;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            close(sv[0]);
+            _exit(spawn_helper_main(sv[1]));
+        }
+        close(sv[1]);
+        if (pid > 0) {
+            sock = sv[0];
+        } else {
+            close(sv[0]);
+        }
+    }
+    
+    // 断开连接，辅助进程随之退出，之后都直接启动 (基准测试用来比较两种方式)
+    void stop() {
+        lock_guard<mutex> guard(lock);
+        if (sock >= 0) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    
+    // 请求辅助进程按args启动子进程，得到与spawn_direct相同的pid和error
+    bool spawn(const SpawnArgs &args, pid_t &pid, int &error) {
+        SpawnRequest request;
+        request.time_limit = args.limits->time_limit;
+        request.memory_limit = args.limits->memory_limit;
+        request.output_limit = args.limits->output_limit;
+        request.cpu = args.limits->cpu;
+        request.has_cgroup = (args.cgroup_procs_fd >= 0);
+        request.inherit_count = args.inherit_count;
+        request.argc = 0;
+        while (args.argv[request.argc] != nullptr) {
+            request.argc++;
+        }
+        string data((const char *)&request, sizeof(request));
+        data.append((const char *)args.inherit_targets, args.inherit_count * sizeof(int));
+        data.append(args.program).push_back('\0');
+        data.append(args.cwd != nullptr ? args.cwd : "").push_back('\0');
+        for (int i = 0; i < request.argc; i++) {
+            data.append(args.argv[i]).push_back('\0');
+        }
+        vector<int> fds = {args.in_fd, args.out_fd, args.err_fd};
+        if (args.cgroup_procs_fd >= 0) {
+            fds.push_back(args.cgroup_procs_fd);
+        }
+        fds.insert(fds.end(), args.inherit_fds, args.inherit_fds + args.inherit_count);
+        if (data.size() > SPAWN_REQUEST_MAX || fds.size() > SPAWN_FDS_MAX) {
+            return false;
+        }
+        
+        vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+        iovec iov = {&data[0], data.size()};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+        
+        lock_guard<mutex> guard(lock);
+        if (sock < 0) {
+            return false;
+        }
+        ssize_t n;
+        while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+        }
+        if (n < 0) {
+            if (errno == EPIPE || errno == ECONNRESET) {
+                // 辅助进程已退出，之后都直接启动
+                close(sock);
+                sock = -1;
+            }
+            return false;
+        }
+        SpawnReply reply;
+        while ((n = recv(sock, &reply, sizeof(reply), 0)) < 0 && errno == EINTR) {
+        }
+        if (n != sizeof(reply)) {
+            // 请求已发出，不知道子进程是否启动，不能再直接启动一次
+            close(sock);
+            sock = -1;
+            reply.pid = -1;
+            reply.error = EIO;
+        }
+        pid = reply.pid;
+        error = reply.error;
+        return true;
+    }
+    
+private:
+    SpawnHelper() {}
+    
+    int sock = -1;
+    mutex lock;
+};
+
+// 启动程序，标准输入/输出/错误接到给定的fd上 (父进程中的fd由调用者关闭)
+// 指定了cgroup目录时放入独立的叶子cgroup，由memory.max/pids.max限制，否则使用RLIMIT_AS
+// args是程序名之后的命令行参数；inherit_fds中的fd按原编号保留给程序 (其余fd都是close-on-exec)；
+// cwd不为空时在该目录下运行
+// 由启动辅助进程clone(CLONE_VM | CLONE_VFORK)，没有辅助进程时直接clone(CLONE_VFORK)；
+// 两种方式都等到子进程exec或退出才返回，exec失败时返回false
+bool spawn_program(const string &program, const vector<string> &args,
+                   int in_fd, int out_fd, int err_fd, const RunLimits &limits, ChildProcess &child,
+                   const vector<int> &inherit_fds = vector<int>(), const string &cwd = "") {
+    child.cgroup_path.clear();
+    int cgroup_procs_fd = -1;
+    if (!limits.cgroup_dir.empty()) {
+        child.cgroup_path = cgroup_create(limits);
+        if (!child.cgroup_path.empty()) {
+            cgroup_procs_fd = open((child.cgroup_path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+            if (cgroup_procs_fd < 0) {
+                cgroup_destroy(child.cgroup_path);
+                child.cgroup_path.clear();
+            }
+        }
+    }
+    
+    // 子进程不能分配内存，argv提前准备好
+    vector<char *> argv;
+    argv.push_back(const_cast<char *>(program.c_str()));
+    for (const auto &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    
+    SpawnArgs spawn_args;
+    spawn_args.program = program.c_str();
+    spawn_args.argv = argv.data();
+    spawn_args.in_fd = in_fd;
+    spawn_args.out_fd = out_fd;
+    spawn_args.err_fd = err_fd;
+    spawn_args.limits = &limits;
+    spawn_args.cgroup_procs_fd = cgroup_procs_fd;
+    spawn_args.inherit_fds = inherit_fds.data();
+    spawn_args.inherit_targets = inherit_fds.data();
+    spawn_args.inherit_count = (int)inherit_fds.size();
+    spawn_args.cwd = cwd.empty() ? nullptr : cwd.c_str();
+    
+    clock_gettime(CLOCK_MONOTONIC, &child.start_time);
+    int error = 0;
+    if (!SpawnHelper::instance().spawn(spawn_args, child.pid, error)) {
+        child.pid = spawn_direct(spawn_args, error);
+    }
+    if (child.pid > 0 && error != 0) {
+        // 子进程在exec之前失败，已经退出
+        waitpid(child.pid, nullptr, 0);
+        child.pid = -1;
+    }
+    
+    if (cgroup_procs_fd >= 0) {
+        close(cgroup_procs_fd);
+    }
+    if (child.pid < 0 && !child.cgroup_path.empty()) {
+        cgroup_destroy(child.cgroup_path);
+        child.cgroup_path.clear();
+    }
+    errno = error;
+    return child.pid > 0;
+}
+
+// 等待子进程退出并收集资源使用情况，超过CPU或墙钟时间限制时由监视线程立即杀死它
+// 还没有调用watch_program时先开始监视，output_pipe不为-1时把其中的输出交给comparator边运行边比对
+JudgeResult wait_program(ChildProcess &child, const RunLimits &limits,
+                         double &time_used, double &wall_time_used, long &memory_used,
+                         int output_pipe = -1, StreamComparator *comparator = nullptr) {
+    if (child.watch == nullptr) {
+        watch_program(child, limits, output_pipe, comparator);
+    }
+    struct rusage usage;
+    JudgeResult verdict = Supervisor::instance().end(child.watch, child.status, usage, wall_time_used);
+    child.watch = nullptr;
+    
+    // 获取时间和内存使用
+    time_used = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+               (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+    memory_used = usage.ru_maxrss;  // KB
+    
+    bool oom_killed = false;
+    if (!child.cgroup_path.empty()) {
+        // cgroup统计包括子进程；memory.peak需要5.19以上的内核
+        long long usage_usec = read_file_key(child.cgroup_path + "/cpu.stat", "usage_usec");
+        if (usage_usec >= 0) {
+            time_used = usage_usec / 1000.0;
+        }
+        long long peak = read_file_value(child.cgroup_path + "/memory.peak");
+        if (peak >= 0) {
+            memory_used = peak / 1024;
+        }
+        oom_killed = read_file_key(child.cgroup_path + "/memory.events", "oom_kill") > 0;
+        cgroup_destroy(child.cgroup_path);
+    }
+    time_used = max(0.0, time_used - child.base_cpu_ms);
+    
+    if (oom_killed) {
+        return MLE;
+    }
+    if (verdict != AC) {
+        return verdict;
+    }
+    
+    // 检查结果
+    int status = child.status;
+    if (WIFEXITED(status)) {
+        if (WEXITSTATUS(status) == 0) {
+            // 检查时间和内存限制
+            if (time_used > limits.time_limit) {
+                return TLE;
+            }
+            if (memory_used > limits.memory_limit * 1024L) {  // 转换为KB
+                return MLE;
+            }
+            return AC;
+        } else {
+            return RE;
+        }
+    } else if (WIFSIGNALED(status)) {
+        int sig = WTERMSIG(status);
+        if (sig == SIGXCPU || sig == SIGALRM) {
+            return TLE;
+        } else if (sig == SIGXFSZ) {
+            return OLE;
+        } else if (sig == SIGSEGV || sig == SIGABRT) {
+            return RE;
+        }
+    }
+    return UKE;
+}
+
+// zygote启动器的源码，与学生程序一样静态链接编译 (经过编译缓存)
+// 启动器只用系统调用，常驻内存很小，exec后计入学生程序的峰值内存可以忽略
+// 启动后先在标准输入上的socket发一个字节表示就绪，然后等待评测机发来三个fd，
+// 换到标准输入/输出/错误后exec学生程序；评测机关闭socket时直接退出
+const char *ZYGOTE_LAUNCHER_SOURCE = R"(#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || write(0, "", 1) != 1) return 0;
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    char byte;
+    struct iovec iov = {&byte, 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(0, &msg, MSG_CMSG_CLOEXEC) <= 0) return 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == 0 || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) return 0;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    if (dup2(fds[0], 0) < 0 || dup2(fds[1], 1) < 0 || dup2(fds[2], 2) < 0) return 127;
+    execv(argv[1], argv + 1);
+    return 127;
+}
+)";
+
+// 在工作目录中编译zygote启动器 (源码固定，通常命中编译缓存)，失败时返回空字符串
+string build_zygote_launcher(const string &work_dir, const Options &options) {
+    string source = work_dir + "/zygote_launcher.cpp";
+    string exe = work_dir + "/zygote_launcher";
+    ofstream file(source);
+    file << ZYGOTE_LAUNCHER_SOURCE;
+    file.close();
+    CompileJob job = start_compile(source, exe, options);
+    ostringstream diagnostics;
+    return finish_compile(job, options, diagnostics) ? exe : "";
+}
+
+// 预先启动的学生程序启动器 (zygote模式)
+// 启动器已经加入cgroup、设置好资源限制和工作目录，阻塞在socket上等待标准输入/输出/错误的fd，
+// 收到后立即exec学生程序；测试点的关键路径上只剩一次exec，启动器的准备与上一个测试点的运行重叠
+// 启动器与其它子进程一样经spawn_program由启动辅助进程启动，准备的开销与评测进程的大小无关
+class Zygote {
+public:
+    Zygote() = default;
+    Zygote(const Zygote &) = delete;
+    Zygote &operator=(const Zygote &) = delete;
+    
+    ~Zygote() {
+        discard();
+    }
+    
+    // 用launcher为program启动一个新的启动器
+    bool prepare(const string &launcher_exe, const string &program, const RunLimits &limits,
+                 const string &cwd) {
+        discard();
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+            return false;
+        }
+        // 启动器的标准输入/输出/错误都先接到socket上，exec学生程序前被替换
+        bool started = spawn_program(launcher_exe, {program}, sv[1], sv[1], sv[1], limits,
+                                     launcher, vector<int>(), cwd);
+        close(sv[1]);
+        if (!started) {
+            close(sv[0]);
+            return false;
+        }
+        socket_fd = sv[0];
+        return true;
+    }
+    
+    // 等待启动器准备好 (它阻塞在socket上之前先发来一个字节)，启动器已退出时返回false
+    bool wait_ready() {
+        if (socket_fd < 0) {
+            return false;
+        }
+        if (!launcher_ready) {
+            char byte;
+            ssize_t n;
+            do {
+                n = read(socket_fd, &byte, 1);
+            } while (n < 0 && errno == EINTR);
+            launcher_ready = (n == 1);
+        }
+        if (!launcher_ready) {
+            discard();
+        }
+        return launcher_ready;
+    }
+    
+    // 把标准输入/输出/错误交给启动器让它exec学生程序，成功时child接管该进程并从现在开始计时
+    bool release(int in_fd, int out_fd, int err_fd, ChildProcess &child) {
+        if (!wait_ready()) {
+            return false;
+        }
+        int fds[3] = {in_fd, out_fd, err_fd};
+        char control[CMSG_SPACE(sizeof(fds))];
+        memset(control, 0, sizeof(control));
+        char byte = 0;
+        iovec iov = {&byte, 1};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        
+        // 启动器自身用掉的CPU时间不计入学生程序
+        clockid_t cpu_clock;
+        double cpu_ms = -1;
+        if (clock_getcpuclockid(launcher.pid, &cpu_clock) == 0) {
+            cpu_ms = read_cpu_ms(launcher.cgroup_path, true, cpu_clock);
+        }
+        launcher.base_cpu_ms = max(0.0, cpu_ms);
+        clock_gettime(CLOCK_MONOTONIC, &launcher.start_time);
+        if (sendmsg(socket_fd, &msg, MSG_NOSIGNAL) != 1) {
+            discard();
+            return false;
+        }
+        close(socket_fd);
+        socket_fd = -1;
+        launcher_ready = false;
+        child = launcher;
+        launcher = ChildProcess();
+        return true;
+    }
+    
+    // 结束没有用上的启动器 (关闭socket后它自行退出)
+    void discard() {
+        if (socket_fd >= 0) {
+            close(socket_fd);
+            socket_fd = -1;
+        }
+        launcher_ready = false;
+        if (launcher.pid > 0) {
+            waitpid(launcher.pid, nullptr, 0);
+            launcher.pid = -1;
+        }
+        if (!launcher.cgroup_path.empty()) {
+            cgroup_destroy(launcher.cgroup_path);
+            launcher.cgroup_path.clear();
+        }
+    }
+    
+private:
+    int socket_fd = -1;
+    bool launcher_ready = false;
+    ChildProcess launcher;
+};
+
+// 压缩的测试数据 (.zst/.gz) 返回解压程序名，其他文件返回nullptr
+const char *decompressor_for(const string &path) {
+    auto ends_with = [&](const char *suffix) {
+        size_t n = strlen(suffix);
+        return path.size() >= n && path.compare(path.size() - n, n, suffix) == 0;
+    };
+    if (ends_with(".zst")) return "zstd";
+    if (ends_with(".gz")) return "gzip";
+    return nullptr;
+}
+
+// 启动解压程序把path解压到out_fd，返回进程号，失败返回-1
+// 解压在独立的进程中进行，用掉的CPU时间不会计入学生程序
+// posix_spawnp按PATH查找程序，glibc用CLONE_VM|CLONE_VFORK实现，不复制评测进程的地址空间
+pid_t start_decompress(const string &path, int out_fd) {
+    const char *tool = decompressor_for(path);
+    vector<string> args = {tool, "-dc", path};
+    vector<char *> argv;
+    for (auto &arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    
+    // 恢复默认信号处理 (特别是SIGPIPE：读取方提前关闭管道时解压程序应当结束)
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t all, none;
+    sigfillset(&all);
+    sigemptyset(&none);
+    posix_spawnattr_setsigdefault(&attr, &all);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    
+    pid_t pid;
+    int error = posix_spawnp(&pid, tool, &actions, &attr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return (error == 0) ? pid : -1;
+}
+
+// 等待解压程序结束；读取方不需要剩余数据而提前关闭管道时解压程序因SIGPIPE结束，也算成功
+bool finish_decompress(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return false;
+    }
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ||
+           (WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE);
+}
+
+// 输入文件缓存：每个输入文件 (或任务包中的一段) 只读一次，复制 (压缩的数据解压) 到密封的memfd中，之后每次运行从内存读取
+// memfd的页面不属于页缓存，不会因为大量评测数据的读取而被换出；总大小受预算限制，超出时淘汰最久未用的项
+// 整个评测进程 (包括常驻模式的所有连接) 共用一个缓存，进程退出前不销毁
+class InputCache {
+public:
+    static InputCache &instance() {
+        static InputCache *cache = new InputCache();
+        return *cache;
+    }
+    
+    // 设置内存预算，0表示关闭缓存；预算变小时立即淘汰
+    void set_budget(long long bytes) {
+        lock_guard<mutex> guard(lock);
+        budget = max(0LL, bytes);
+        evict(0);
+    }
+    
+    // 返回path内容的只读fd，由调用者关闭；不缓存或缓存失败时返回-1，调用者自己打开文件
+    // size不为-1时只取文件中从offset开始的size字节 (任务包中的测试数据)
+    // 每次通过/proc/self/fd重新打开memfd，得到独立的读取位置，并发运行的程序互不影响
+    int open(const string &path, long long offset = 0, long long size = -1) {
+        string key = (size < 0) ? path : path + "@" + to_string(offset) + "+" + to_string(size);
+        struct stat st;
+        {
+            lock_guard<mutex> guard(lock);
+            if (budget == 0 || stat(path.c_str(), &st) != 0) {
+                return -1;
+            }
+            if (size < 0) {
+                offset = 0;
+                size = st.st_size;
+            }
+            if (size > budget) {
+                return -1;  // 压缩文件解压后只会更大
+            }
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                if (same_file(it->second, st)) {
+                    it->second.last_used = ++clock;
+                    return reopen(it->second.fd);
+                }
+                remove_entry(it);
+            }
+        }
+        
+        // 复制文件时不持有锁，其他线程可以同时使用已缓存的输入
+        Entry entry;
+        bool compressed = key == path && decompressor_for(path) != nullptr;
+        entry.fd = compressed ? load_decompressed(path) : load(path, offset, size);
+        struct stat loaded;
+        if (entry.fd < 0 || fstat(entry.fd, &loaded) != 0) {
+            if (entry.fd >= 0) close(entry.fd);
+            return -1;
+        }
+        entry.dev = st.st_dev;
+        entry.ino = st.st_ino;
+        entry.mtime = st.st_mtim;
+        entry.file_size = st.st_size;
+        entry.size = loaded.st_size;
+        
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(key);
+        if (it != entries.end() && same_file(it->second, st)) {
+            // 另一个线程先完成了复制
+            close(entry.fd);
+        } else {
+            if (it != entries.end()) {
+                remove_entry(it);
+            }
+            if (entry.size > budget) {
+                return entry.fd;  // 解压后超出预算，这一次直接使用，不放入缓存
+            }
+            evict(entry.size);
+            used += entry.size;
+            it = entries.insert(make_pair(key, entry)).first;
+        }
+        it->second.last_used = ++clock;
+        return reopen(it->second.fd);
+    }
+    
+    // 把压缩文件解压到密封的memfd，返回的memfd由调用者关闭；不经过缓存
+    static int load_decompressed(const string &path) {
+        int fd = memfd_create("judge_input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) {
+            return -1;
+        }
+        pid_t pid = start_decompress(path, fd);
+        bool ok = pid > 0 && finish_decompress(pid) && lseek(fd, 0, SEEK_SET) == 0 &&
+                  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0;
+        if (!ok) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    
+    // 把文件中从offset开始的size字节复制到memfd并加上全部密封，之后任何人都无法修改内容
+    // 返回的memfd由调用者关闭，读取位置在开头；不经过缓存
+    static int load(const string &path, long long offset, long long size) {
+        int file_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file_fd < 0) {
+            return -1;
+        }
+        int fd = memfd_create("judge_input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        bool ok = fd >= 0 && ftruncate(fd, size) == 0;
+        off_t position = offset;
+        while (ok && position < offset + size) {
+            ssize_t n = sendfile(fd, file_fd, &position, offset + size - position);
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0;
+        }
+        close(file_fd);
+        ok = ok && lseek(fd, 0, SEEK_SET) == 0 &&
+             fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0;
+        if (!ok) {
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    
+private:
+    struct Entry {
+        int fd = -1;
+        dev_t dev = 0;
+        ino_t ino = 0;
+        timespec mtime = {0, 0};
+        long long file_size = 0;    // 源文件的大小，与dev/ino/mtime一起判断文件是否被修改
+        long long size = 0;         // 缓存的字节数
+        unsigned long last_used = 0;
+    };
+    
+    InputCache() {}
+    
+    static bool same_file(const Entry &entry, const struct stat &st) {
+        return entry.dev == st.st_dev && entry.ino == st.st_ino && entry.file_size == st.st_size &&
+               entry.mtime.tv_sec == st.st_mtim.tv_sec && entry.mtime.tv_nsec == st.st_mtim.tv_nsec;
+    }
+    
+    // 在持有锁时调用：淘汰期间fd不会被关闭，编号不会被复用
+    static int reopen(int fd) {
+        return ::open(("/proc/self/fd/" + to_string(fd)).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    
+    void remove_entry(map<string, Entry>::iterator it) {
+        used -= it->second.size;
+        close(it->second.fd);
+        entries.erase(it);
+    }
+    
+    // 淘汰最久未用的项，直到再放入incoming字节不超过预算
+    void evict(long long incoming) {
+        while (!entries.empty() && used + incoming > budget) {
+            auto oldest = entries.begin();
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                if (it->second.last_used < oldest->second.last_used) oldest = it;
+            }
+            remove_entry(oldest);
+        }
+    }
+    
+    mutex lock;
+    map<string, Entry> entries;
+    long long budget = 0;
+    long long used = 0;
+    unsigned long clock = 0;
+};
+
+// 创建捕获输出用的内存文件 (memfd)，不经过文件系统
+int create_capture(const char *name) {
+    return memfd_create(name, MFD_CLOEXEC);
+}
+
+// 子进程通过路径打开父进程传给它的fd (testlib的checker和交互器只接受文件名)
+string fd_path(int fd) {
+    return "/proc/self/fd/" + to_string(fd);
+}
+
+// 测试点的输入或标准输出的只读fd：普通文件、输入缓存中的memfd，或者读取方边读边写入的管道：
+// 压缩数据没有进入缓存时由解压程序写入，任务包中的一段没有进入缓存时由线程从任务包的映射写入
+// 交给checker等子进程时让子进程继承fd，以path()作为文件名
+class TestData {
+public:
+    TestData() {}
+    TestData(const TestData &) = delete;
+    TestData &operator=(const TestData &) = delete;
+    ~TestData() {
+        finish();
+    }
+    
+    // 打开point的输入 (answer为true时为标准输出)
+    bool open(const TestPoint &point, bool answer) {
+        if (point.pack) {
+            const PackEntry &entry = *point.pack_entry;
+            long long offset = answer ? entry.output_offset : entry.input_offset;
+            long long size = answer ? entry.output_size : entry.input_size;
+            data_fd = InputCache::instance().open(point.pack->path, offset, size);
+            return data_fd >= 0 || feed(point.pack, offset, size);
+        }
+        const string &file = answer ? point.output_file : point.input_file;
+        data_fd = InputCache::instance().open(file);
+        if (data_fd >= 0) {
+            return true;
+        }
+        if (decompressor_for(file) == nullptr) {
+            data_fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            return data_fd >= 0;
+        }
+        int pipe_fds[2];
+        if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+            return false;
+        }
+        decompressor = start_decompress(file, pipe_fds[1]);
+        close(pipe_fds[1]);
+        if (decompressor < 0) {
+            close(pipe_fds[0]);
+            return false;
+        }
+        data_fd = pipe_fds[0];
+        return true;
+    }
+    
+    int fd() const {
+        return data_fd;
+    }
+    
+    string path() const {
+        return fd_path(data_fd);
+    }
+    
+    // 数据来自管道，只能顺序读取一遍，不能映射
+    bool streaming() const {
+        return decompressor > 0 || feeder.joinable();
+    }
+    
+    // 关闭fd并等待解压程序或写入线程结束 (必须在读取数据的子进程结束之后)，解压失败时返回false
+    // 读取方没有读完时写入方因管道关闭而结束
+    bool finish() {
+        if (data_fd >= 0) {
+            close(data_fd);
+            data_fd = -1;
+        }
+        bool ok = true;
+        if (decompressor > 0) {
+            ok = finish_decompress(decompressor);
+            decompressor = -1;
+        }
+        if (feeder.joinable()) {
+            feeder.join();
+        }
+        return ok;
+    }
+    
+private:
+    // 把任务包映射中从offset开始的size字节经管道交给读取方，不复制整段数据
+    bool feed(const shared_ptr<TaskPack> &pack, long long offset, long long size) {
+        int pipe_fds[2];
+        if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+            return false;
+        }
+        data_fd = pipe_fds[0];
+        int write_fd = pipe_fds[1];
+        feeder = thread([pack, offset, size, write_fd]() {
+            // 读取方提前关闭管道时write返回EPIPE，发给本线程的SIGPIPE被屏蔽
+            sigset_t pipe_signal;
+            sigemptyset(&pipe_signal);
+            sigaddset(&pipe_signal, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &pipe_signal, nullptr);
+            const char *data = pack->file.data() + offset;
+            long long done = 0;
+            while (done < size) {
+                ssize_t n = write(write_fd, data + done, min(size - done, 1LL << 20));
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                done += n;
+            }
+            close(write_fd);
+        });
+        return true;
+    }
+    
+    int data_fd = -1;
+    pid_t decompressor = -1;
+    thread feeder;
+};
+
+// 把data的全部内容追加到out_fd，同时计算SHA-256，返回写入的字节数 (失败返回-1)；out_fd为-1时只计算哈希
+long long append_hashed(int out_fd, TestData &data, unsigned char hash[32]) {
+    Sha256 sha;
+    vector<char> buffer(1 << 20);
+    long long total = 0;
+    ssize_t n;
+    while ((n = read(data.fd(), buffer.data(), buffer.size())) > 0) {
+        sha.update(buffer.data(), n);
+        for (ssize_t done = 0; out_fd >= 0 && done < n; ) {
+            ssize_t written = write(out_fd, buffer.data() + done, n - done);
+            if (written <= 0) {
+                return -1;
+            }
+            done += written;
+        }
+        total += n;
+    }
+    if (n < 0 || !data.finish()) {
+        return -1;
+    }
+    sha.digest(hash);
+    return total;
+}
+
+// judge pack：把题目目录中的env和全部测试点打包成一个文件，压缩的测试数据解压后存入
+// 先写到临时文件，完成后改名，正在评测的进程仍使用旧包的映射
+int pack_task(const string &task_dir, const string &pack_file) {
+    vector<TestPoint> test_points = get_test_points(task_dir, vector<int>(), cerr);
+    if (test_points.empty()) {
+        cerr << "未找到测试点: " << task_dir << endl;
+        return 1;
+    }
+    string env;
+    {
+        ifstream env_file(task_dir + "/env");
+        stringstream content;
+        content << env_file.rdbuf();
+        env = content.str();
+    }
+    
+    string temp_file = pack_file + ".tmp";
+    int fd = open(temp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        cerr << "无法创建任务包: " << temp_file << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    PackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.point_count = test_points.size();
+    header.index_offset = sizeof(PackHeader);
+    header.env_offset = header.index_offset + sizeof(PackEntry) * test_points.size();
+    header.env_size = env.size();
+    vector<PackEntry> entries(test_points.size());
+    
+    // 文件头和索引最后写入，先跳过它们的位置
+    bool ok = lseek(fd, header.env_offset, SEEK_SET) >= 0 &&
+              write(fd, env.data(), env.size()) == (ssize_t)env.size();
+    uint64_t offset = header.env_offset + env.size();
+    for (size_t i = 0; i < test_points.size() && ok; i++) {
+        PackEntry &entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.number = test_points[i].number;
+        TestData input, answer;
+        long long input_size = !input.open(test_points[i], false) ? -1
+                             : append_hashed(fd, input, entry.input_hash);
+        long long output_size = (input_size < 0 || !answer.open(test_points[i], true)) ? -1
+                              : append_hashed(fd, answer, entry.output_hash);
+        ok = input_size >= 0 && output_size >= 0;
+        entry.input_offset = offset;
+        entry.input_size = input_size;
+        entry.output_offset = offset + input_size;
+        entry.output_size = output_size;
+        offset += input_size + output_size;
+    }
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+         pwrite(fd, entries.data(), sizeof(PackEntry) * entries.size(), header.index_offset) ==
+             (ssize_t)(sizeof(PackEntry) * entries.size());
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(temp_file.c_str(), pack_file.c_str()) != 0) {
+        cerr << "写入任务包失败: " << pack_file << ": " << strerror(errno) << endl;
+        remove(temp_file.c_str());
+        return 1;
+    }
+    cout << "已打包 " << test_points.size() << " 个测试点到 " << pack_file
+         << " (" << offset << "字节)" << endl;
+    return 0;
+}
+
+// 运行程序并收集资源使用情况
+// 标准输入来自input_fd，标准输出写到output_fd，标准错误写到error_fd (都由调用者持有)；
+// 传入comparator时标准输出改为接到管道上边运行边比对；cwd不为空时在该目录下运行
+// 传入zygote时交给预先启动的启动器exec，随后用launcher_exe为下一次运行准备新的启动器
+// status不为nullptr时取得程序的退出状态 (wait4)
+JudgeResult run_program(const string &program, int input_fd,
+                       int output_fd, int error_fd, const RunLimits &limits,
+                       double &time_used, double &wall_time_used, long &memory_used,
+                       StreamComparator *comparator = nullptr, const string &cwd = "",
+                       Zygote *zygote = nullptr, const string &launcher_exe = "",
+                       int *status = nullptr) {
+    int output_pipe[2] = {-1, -1};
+    if (comparator != nullptr && pipe2(output_pipe, O_CLOEXEC) != 0) {
+        return UKE;
+    }
+    int out_fd = (comparator != nullptr) ? output_pipe[1] : output_fd;
+    
+    ChildProcess child;
+    bool started = input_fd >= 0 && out_fd >= 0 && error_fd >= 0 &&
+                   ((zygote != nullptr && zygote->release(input_fd, out_fd, error_fd, child)) ||
+                    spawn_program(program, vector<string>(), input_fd, out_fd, error_fd, limits, child,
+                                  vector<int>(), cwd));
+    if (output_pipe[1] >= 0) close(output_pipe[1]);
+    if (!started) {
+        if (output_pipe[0] >= 0) close(output_pipe[0]);
+        return UKE;
+    }
+    
+    if (comparator != nullptr) {
+        fcntl(output_pipe[0], F_SETFL, O_NONBLOCK);
+    }
+    if (zygote != nullptr) {
+        zygote->prepare(launcher_exe, program, limits, cwd);
+    }
+    JudgeResult result = wait_program(child, limits, time_used, wall_time_used, memory_used,
+                                      output_pipe[0], comparator);
+    if (output_pipe[0] >= 0) {
+        close(output_pipe[0]);
+    }
+    if (status != nullptr) {
+        *status = child.status;
+    }
+    return result;
+}
+
+// 评测结果转字符串
+string result_to_string(JudgeResult result) {
+    switch (result) {
+        case AC: return "AC";
+        case WA: return "WA";
+        case TLE: return "TLE";
+        case MLE: return "MLE";
+        case OLE: return "OLE";
+        case RE: return "RE";
+        case UKE: return "UKE";
+        case SKIPPED: return "Skipped";
+        default: return "UKE";
+    }
+}
+
+// 逐行读取的旧版文本比对，保留作为compare_buffers的对照和基准测试
+JudgeResult normal_judge_getline(const string &std_output, const string &user_output) {
+    ifstream std_file(std_output);
+    ifstream user_file(user_output);
+    
+    if (!std_file.is_open() || !user_file.is_open()) {
+        return UKE;
+    }
+    
+    string std_line, user_line;
+    while (getline(std_file, std_line)) {
+        if (!getline(user_file, user_line)) {
+            return WA;
+        }
+        
+        // 去除行尾空格
+        std_line.erase(std_line.find_last_not_of(" \t\n\r\f\v") + 1);
+        user_line.erase(user_line.find_last_not_of(" \t\n\r\f\v") + 1);
+        
+        if (std_line != user_line) {
+            return WA;
+        }
+    }
+    
+    // 检查用户输出是否有多余行
+    if (getline(user_file, user_line)) {
+        user_line.erase(user_line.find_last_not_of(" \t\n\r\f\v") + 1);
+        if (!user_line.empty()) {
+            return WA;
+        }
+    }
+    
+    return AC;
+}
+
+// 求a和b的公共前缀长度，同时统计前缀中的换行数
+typedef size_t (*PrefixKernel)(const char *a, const char *b, size_t n, size_t &newlines);
+
+size_t common_prefix_scalar(const char *a, const char *b, size_t n, size_t &newlines) {
+    const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+    size_t i = 0;
+    // 每次比较8字节，相同的块用SWAR统计等于'\n'的字节数
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y) break;
+        uint64_t v = x ^ 0x0A0A0A0A0A0A0A0AULL;
+        uint64_t zero_bytes = ~(((v & low7) + low7) | v | low7);
+        newlines += __builtin_popcountll(zero_bytes);
+    }
+    for (; i < n && a[i] == b[i]; i++) {
+        newlines += (a[i] == '\n');
+    }
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2,popcnt")))
+size_t common_prefix_sse2(const char *a, const char *b, size_t n, size_t &newlines) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        unsigned eq = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        unsigned lines = _mm_movemask_epi8(_mm_cmpeq_epi8(va, nl));
+        if (eq != 0xFFFF) {
+            unsigned k = __builtin_ctz(~eq);
+            newlines += __builtin_popcount(lines & ((1u << k) - 1));
+            return i + k;
+        }
+        newlines += __builtin_popcount(lines);
+    }
+    return i + common_prefix_scalar(a + i, b + i, n - i, newlines);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t common_prefix_avx2(const char *a, const char *b, size_t n, size_t &newlines) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        unsigned eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        unsigned lines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, nl));
+        if (eq != 0xFFFFFFFFu) {
+            unsigned k = __builtin_ctz(~eq);
+            newlines += __builtin_popcount(lines & ((1u << k) - 1));
+            return i + k;
+        }
+        newlines += __builtin_popcount(lines);
+    }
+    return i + common_prefix_sse2(a + i, b + i, n - i, newlines);
+}
+#endif
+
+// 运行时按CPU支持的指令集选择实现
+PrefixKernel select_prefix_kernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return common_prefix_avx2;
+    }
+    if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+        return common_prefix_sse2;
+    }
+#endif
+    return common_prefix_scalar;
+}
+
+// 去除行尾空白后的长度 (与find_last_not_of(" \t\n\r\f\v")一致)
+size_t trimmed_length(const char *line, size_t len) {
+    while (len > 0) {
+        char c = line[len - 1];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != '\v') break;
+        len--;
+    }
+    return len;
+}
+
+// 按normal_judge_getline的规则比较两个缓冲区，结果完全相同：
+// 逐行比较 (行尾空白和CRLF的\r被忽略)，标准输出结束后用户输出最多允许再有一个空白行
+// 两边字节相同的部分用SIMD一次跳过，只在出现差异的行上逐行处理
+JudgeResult compare_buffers(const char *std_data, size_t std_size,
+                            const char *user_data, size_t user_size,
+                            CompareDiff *diff = nullptr, PrefixKernel kernel = nullptr) {
+    static const PrefixKernel best_kernel = select_prefix_kernel();
+    if (kernel == nullptr) {
+        kernel = best_kernel;
+    }
+    
+    size_t ps = 0, pu = 0;
+    long line = 1;
+    while (true) {
+        // 跳过相同的字节，定位到第一处差异所在行的行首
+        size_t newlines = 0;
+        size_t same = kernel(std_data + ps, user_data + pu,
+                             min(std_size - ps, user_size - pu), newlines);
+        if (newlines > 0) {
+            const char *last_nl = (const char *)memrchr(std_data + ps, '\n', same);
+            size_t advance = last_nl - (std_data + ps) + 1;
+            ps += advance;
+            pu += advance;
+            line += newlines;
+        }
+        
+        const char *user_line = user_data + pu;
+        const char *user_end = (const char *)memchr(user_line, '\n', user_size - pu);
+        size_t user_len = (user_end != nullptr) ? user_end - user_line : user_size - pu;
+        size_t user_trim = trimmed_length(user_line, user_len);
+        
+        if (ps >= std_size) {
+            // 标准输出已结束，只检查用户输出多余的第一行
+            if (pu >= user_size || user_trim == 0) {
+                return AC;
+            }
+            if (diff != nullptr) {
+                size_t col = 0;
+                while (trimmed_length(user_line, col + 1) == 0) col++;
+                diff->line = line;
+                diff->column = col + 1;
+                diff->offset = pu + col;
+            }
+            return WA;
+        }
+        
+        const char *std_line = std_data + ps;
+        const char *std_end = (const char *)memchr(std_line, '\n', std_size - ps);
+        size_t std_len = (std_end != nullptr) ? std_end - std_line : std_size - ps;
+        size_t std_trim = trimmed_length(std_line, std_len);
+        
+        if (pu >= user_size || std_trim != user_trim || memcmp(std_line, user_line, std_trim) != 0) {
+            if (diff != nullptr) {
+                // 与流式比对报告的位置一致：行尾空白中能对上的部分不算差异
+                size_t col = 0;
+                if (pu < user_size) {
+                    while (col < std_trim && col < user_len && std_line[col] == user_line[col]) col++;
+                    if (col == std_trim) {
+                        while (col < user_len && trimmed_length(user_line + col, 1) == 0) col++;
+                    }
+                }
+                diff->line = line;
+                diff->column = col + 1;
+                diff->offset = pu + col;
+            }
+            return WA;
+        }
+        
+        // 这一行只有行尾空白不同
+        ps += std_len + 1;
+        pu += user_len + 1;
+        line++;
+        if (ps > std_size) ps = std_size;
+        if (pu > user_size) pu = user_size;
+    }
+}
+
+// 按空白分隔逐个读取单词，记录单词所在的行号和行首，用于报告差异位置
+class TokenReader {
+public:
+    TokenReader(const char *data, size_t size) : p(data), end(data + size), begin(data), line_start(data) {}
+    
+    bool next(const char *&token, size_t &length) {
+        while (p < end && is_space(*p)) {
+            if (*p == '\n') {
+                line++;
+                line_start = p + 1;
+            }
+            p++;
+        }
+        if (p == end) {
+            return false;
+        }
+        token = p;
+        while (p < end && !is_space(*p)) p++;
+        length = p - token;
+        return true;
+    }
+    
+    // 把pos (当前行中的位置) 记为第一处差异
+    void report(const char *pos, CompareDiff *diff) const {
+        if (diff != nullptr) {
+            diff->line = line;
+            diff->column = pos - line_start + 1;
+            diff->offset = pos - begin;
+        }
+    }
+    
+    const char *position() const {
+        return p;
+    }
+    
+private:
+    static bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+    
+    const char *p;
+    const char *end;
+    const char *begin;
+    const char *line_start;
+    long line = 1;
+};
+
+// 解析一个完整的十进制实数单词 (可带符号、小数点和指数)，不是实数时返回false
+// 有效数字不超过19位时用64位整数尾数乘10的幂得到结果，不为每个单词构造string调用stod
+bool parse_number(const char *s, size_t n, double &value) {
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    size_t i = 0;
+    bool negative = false;
+    if (i < n && (s[i] == '+' || s[i] == '-')) {
+        negative = s[i] == '-';
+        i++;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0, significant = 0, exponent = 0;
+    bool point = false;
+    for (; i < n; i++) {
+        char c = s[i];
+        if (c >= '0' && c <= '9') {
+            digits++;
+            if (significant < 19) {
+                if (mantissa != 0 || c != '0') significant++;
+                mantissa = mantissa * 10 + (c - '0');
+                if (point) exponent--;
+            } else if (!point) {
+                exponent++;  // 超出19位的整数部分只计数量级
+            }
+        } else if (c == '.' && !point) {
+            point = true;
+        } else {
+            break;
+        }
+    }
+    if (digits == 0) {
+        return false;
+    }
+    if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        bool exp_negative = false;
+        if (i < n && (s[i] == '+' || s[i] == '-')) {
+            exp_negative = s[i] == '-';
+            i++;
+        }
+        int exp_digits = 0, exp_value = 0;
+        for (; i < n && s[i] >= '0' && s[i] <= '9'; i++) {
+            exp_digits++;
+            if (exp_value < 100000) exp_value = exp_value * 10 + (s[i] - '0');
+        }
+        if (exp_digits == 0) {
+            return false;
+        }
+        exponent += exp_negative ? -exp_value : exp_value;
+    }
+    if (i != n) {
+        return false;
+    }
+    if (significant >= 19 || exponent < -22 || exponent > 22) {
+        // 罕见的长尾数或大指数交给strtod，保证精度
+        string text(s, n);
+        value = strtod(text.c_str(), nullptr);
+        return true;
+    }
+    value = (exponent < 0) ? mantissa / powers[-exponent] : mantissa * powers[exponent];
+    if (negative) value = -value;
+    return true;
+}
+
+// 实数误差判断，与testlib的doubleCompare相同：绝对误差或相对误差之一在范围内即可
+bool close_enough(double expected, double result, double absolute_error, double relative_error) {
+    if (std::isnan(expected) || std::isnan(result)) {
+        return false;
+    }
+    double difference = fabs(expected - result);
+    return difference <= absolute_error + 1e-15 || difference <= relative_error * fabs(expected) + 1e-15;
+}
+
+// 单词、实数和忽略大小写比较：两边的单词序列逐个比较
+JudgeResult compare_tokens(const Config &config, const char *std_data, size_t std_size,
+                           const char *user_data, size_t user_size, CompareDiff *diff) {
+    TokenReader expected(std_data, std_size), user(user_data, user_size);
+    const char *a = nullptr, *b = nullptr;
+    size_t a_len = 0, b_len = 0;
+    while (true) {
+        bool has_expected = expected.next(a, a_len);
+        bool has_user = user.next(b, b_len);
+        if (!has_expected && !has_user) {
+            return AC;
+        }
+        bool same = has_expected && has_user;
+        if (same && config.comparator == FLOAT_COMPARE) {
+            double x, y;
+            if (parse_number(a, a_len, x) && parse_number(b, b_len, y)) {
+                same = close_enough(x, y, config.absolute_error, config.relative_error);
+            } else {
+                same = a_len == b_len && memcmp(a, b, a_len) == 0;
+            }
+        } else if (same && config.comparator == CASE_FOLD_COMPARE) {
+            same = a_len == b_len;
+            for (size_t i = 0; same && i < a_len; i++) {
+                same = tolower((unsigned char)a[i]) == tolower((unsigned char)b[i]);
+            }
+        } else if (same) {
+            same = a_len == b_len && memcmp(a, b, a_len) == 0;
+        }
+        if (!same) {
+            user.report(has_user ? b : user.position(), diff);
+            return WA;
+        }
+    }
+}
+
+// 行集合比较：两边去除行尾空白和末尾空行后，排序比较所有行
+JudgeResult compare_line_sets(const char *std_data, size_t std_size,
+                              const char *user_data, size_t user_size) {
+    typedef pair<const char *, size_t> Line;
+    auto split_lines = [](const char *data, size_t size) {
+        vector<Line> lines;
+        const char *p = data, *end = data + size;
+        while (p < end) {
+            const char *nl = (const char *)memchr(p, '\n', end - p);
+            size_t len = (nl != nullptr) ? nl - p : end - p;
+            lines.push_back(Line(p, trimmed_length(p, len)));
+            p += len + 1;
+        }
+        while (!lines.empty() && lines.back().second == 0) {
+            lines.pop_back();
+        }
+        sort(lines.begin(), lines.end(), [](const Line &x, const Line &y) {
+            int c = memcmp(x.first, y.first, min(x.second, y.second));
+            return c != 0 ? c < 0 : x.second < y.second;
+        });
+        return lines;
+    };
+    vector<Line> expected = split_lines(std_data, std_size);
+    vector<Line> user = split_lines(user_data, user_size);
+    if (expected.size() != user.size()) {
+        return WA;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (expected[i].second != user[i].second ||
+            memcmp(expected[i].first, user[i].first, expected[i].second) != 0) {
+            return WA;
+        }
+    }
+    return AC;
+}
+
+// 按config中的比较方式比较标准输出和用户输出
+JudgeResult compare_output(const Config &config, const char *std_data, size_t std_size,
+                           const char *user_data, size_t user_size, CompareDiff *diff = nullptr) {
+    switch (config.comparator) {
+        case TEXT_COMPARE:
+            return compare_buffers(std_data, std_size, user_data, user_size, diff);
+        case LINE_SET_COMPARE:
+            return compare_line_sets(std_data, std_size, user_data, user_size);
+        default:
+            return compare_tokens(config, std_data, std_size, user_data, user_size, diff);
+    }
+}
+
+// 文本比对基准测试：对比逐行读取的旧实现和mmap+SIMD实现的吞吐量
+int bench_compare(const string &std_output, const string &user_output, int rounds) {
+    MappedFile std_file, user_file;
+    if (!std_file.open(std_output) || !user_file.open(user_output)) {
+        cerr << "无法打开文件" << endl;
+        return 1;
+    }
+    double bytes = (double)std_file.size() + user_file.size();
+    
+    struct Variant {
+        const char *name;
+        PrefixKernel kernel;
+    };
+    vector<Variant> variants;
+    variants.push_back({"scalar", common_prefix_scalar});
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+        variants.push_back({"sse2", common_prefix_sse2});
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        variants.push_back({"avx2", common_prefix_avx2});
+    }
+#endif
+    
+    cout << "文件大小: " << std_file.size() << " + " << user_file.size() << " 字节, "
+         << rounds << " 轮" << endl;
+    
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    JudgeResult result = UKE;
+    for (int r = 0; r < rounds; r++) {
+        result = normal_judge_getline(std_output, user_output);
+    }
+    double ms = elapsed_ms(start) / rounds;
+    cout << "getline: " << result_to_string(result) << ", " << ms << "ms, "
+         << bytes / ms / 1e6 << " GB/s" << endl;
+    
+    for (const auto &variant : variants) {
+        CompareDiff diff;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++) {
+            result = compare_buffers(std_file.data(), std_file.size(),
+                                     user_file.data(), user_file.size(), &diff, variant.kernel);
+        }
+        ms = elapsed_ms(start) / rounds;
+        cout << "mmap+" << variant.name << ": " << result_to_string(result) << ", " << ms << "ms, "
+             << bytes / ms / 1e6 << " GB/s";
+        if (result == WA) {
+            cout << " (第" << diff.line << "行第" << diff.column << "列, 偏移" << diff.offset << ")";
+        }
+        cout << endl;
+    }
+    return 0;
+}
+
+// 进程启动基准测试：分别用fork+exec、system()、启动辅助进程、zygote启动器和直接clone启动/bin/true并等待它退出
+// zygote只计从交出fd到进程退出的时间 (启动器的准备与上一次运行重叠，不在关键路径上)
+// ballast_mb不为0时先占用并写入这么多内存，模拟常驻评测服务这样的大进程 (fork要复制它的页表)；
+// 启动辅助进程在占用内存之前启动，与评测时一样
+int bench_spawn(int rounds, long ballast_mb) {
+    if (rounds <= 0) rounds = 1000;
+    const char *program = "/bin/true";
+    SpawnHelper::instance().start();
+    vector<char> ballast((size_t)max(0L, ballast_mb) * 1024 * 1024, 1);
+    cout << "启动次数: " << rounds << ", 进程额外占用内存: " << ballast_mb << "MB" << endl;
+    
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    Options options;
+    options.zygote = true;
+    WorkDir work(options.work_root);
+    string launcher_exe = work.valid() ? build_zygote_launcher(work.path(), options) : "";
+    RunLimits limits;
+    limits.time_limit = 1000;
+    limits.wall_time_limit = 2000;
+    limits.memory_limit = 512;
+    limits.process_limit = 64;
+    
+    for (int method = 0; method < 5; method++) {
+        if (method == 4) {
+            SpawnHelper::instance().stop();
+        }
+        double total_ms = 0;
+        bool ok = true;
+        for (int r = 0; r < rounds && ok; r++) {
+            Zygote zygote;
+            if (method == 3) {
+                ok = zygote.prepare(launcher_exe, program, limits, "") && zygote.wait_ready();
+            }
+            timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (method == 0) {
+                pid_t pid = fork();
+                if (pid == 0) {
+                    dup2(null_fd, STDOUT_FILENO);
+                    execl(program, program, (char *)nullptr);
+                    _exit(127);
+                }
+                ok = pid > 0 && waitpid(pid, nullptr, 0) == pid;
+            } else if (method == 1) {
+                ok = system(program) == 0;
+            } else if (method == 3) {
+                ChildProcess child;
+                ok = ok && zygote.release(null_fd, null_fd, null_fd, child) &&
+                     waitpid(child.pid, nullptr, 0) == child.pid;
+            } else {
+                ChildProcess child;
+                ok = spawn_program(program, vector<string>(), null_fd, null_fd, null_fd, limits, child) &&
+                     waitpid(child.pid, nullptr, 0) == child.pid;
+            }
+            total_ms += elapsed_ms(start);
+        }
+        const char *names[] = {"fork + exec", "system()", "启动辅助进程 clone(CLONE_VM|CLONE_VFORK)",
+                               "zygote", "直接clone(CLONE_VFORK)"};
+        if (ok) {
+            cout << names[method] << ": " << total_ms * 1000 / rounds << " us/次" << endl;
+        } else {
+            cout << names[method] << ": 失败" << endl;
+        }
+    }
+    close(null_fd);
+    return 0;
+}
+
+// 评测过程中的诊断信息 (SPJ错误、测试数据解压失败等)，写到本次评测的错误输出
+// 常驻模式下是发给客户端的err流；多个工作线程同时报告，每条消息加锁后整条写出
+class Diagnostics {
+public:
+    explicit Diagnostics(ostream &stream) : stream(stream) {}
+    
+    void report(const string &message) {
+        lock_guard<mutex> lock(mtx);
+        stream << message << endl;
+    }
+    
+private:
+    ostream &stream;
+    mutex mtx;
+};
+
+// 把checker或交互器捕获到memfd中的错误输出转到本次评测的错误输出
+void report_program_error(Diagnostics &diagnostics, const string &prefix, int error_fd) {
+    MappedFile error_output;
+    if (error_fd < 0 || !error_output.map(error_fd)) {
+        return;
+    }
+    istringstream error_stream(string(error_output.data(), error_output.size()));
+    string line, message;
+    while (getline(error_stream, line)) {
+        message += (message.empty() ? "" : "\n") + prefix + line;
+    }
+    if (!message.empty()) {
+        diagnostics.report(message);
+    }
+}
+
+// 两个进程通过一对管道来回传递一行短消息，返回平均每次往返的纳秒数
+// cpu不为-1时发送方绑定到cpu，回声进程绑定到echo_cpu
+double pingpong_round_trip(long rounds, int cpu, int echo_cpu) {
+    int ping[2], pong[2];
+    if (pipe(ping) != 0) return -1;
+    if (pipe(pong) != 0) {
+        close(ping[0]);
+        close(ping[1]);
+        return -1;
+    }
+    cpu_set_t old_set, set;
+    sched_getaffinity(0, sizeof(old_set), &old_set);
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        // 回声进程：读到什么就写回什么，直到管道关闭
+        if (cpu >= 0) {
+            CPU_ZERO(&set);
+            CPU_SET(echo_cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+        close(ping[1]);
+        close(pong[0]);
+        char buffer[64];
+        ssize_t n;
+        while ((n = read(ping[0], buffer, sizeof(buffer))) > 0) {
+            if (write(pong[1], buffer, n) != n) break;
+        }
+        _exit(0);
+    }
+    close(ping[0]);
+    close(pong[1]);
+    
+    double result = -1;
+    if (pid > 0) {
+        const char message[] = "? 123456\n";
+        char buffer[64];
+        timespec start;
+        for (long r = -rounds / 10 - 1; r < rounds; r++) {
+            if (r == 0) clock_gettime(CLOCK_MONOTONIC, &start);  // 前面的轮次用于预热
+            if (write(ping[1], message, sizeof(message) - 1) != (ssize_t)sizeof(message) - 1 ||
+                read(pong[0], buffer, sizeof(buffer)) <= 0) {
+                rounds = 0;
+                break;
+            }
+        }
+        if (rounds > 0) {
+            result = elapsed_ms(start) * 1e6 / rounds;
+        }
+    }
+    close(ping[1]);
+    close(pong[0]);
+    if (pid > 0) waitpid(pid, nullptr, 0);
+    sched_setaffinity(0, sizeof(old_set), &old_set);
+    return result;
+}
+
+// 交互管道往返延迟基准测试：比较不绑定CPU、两个进程绑定到同一个CPU和不同CPU时的往返时间
+int bench_pingpong(long rounds) {
+    if (rounds <= 0) rounds = 100000;
+    vector<int> cpus;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed)) cpus.push_back(c);
+        }
+    }
+    cout << "往返次数: " << rounds << ", 可用CPU: " << cpus.size() << endl;
+    
+    double free_ns = pingpong_round_trip(rounds, -1, -1);
+    if (free_ns < 0) {
+        cerr << "无法创建管道或子进程" << endl;
+        return 1;
+    }
+    cout << "不绑定CPU: " << free_ns << " ns/往返" << endl;
+    if (!cpus.empty()) {
+        cout << "绑定同一CPU: " << pingpong_round_trip(rounds, cpus[0], cpus[0]) << " ns/往返" << endl;
+    }
+    if (cpus.size() >= 2) {
+        cout << "绑定不同CPU: " << pingpong_round_trip(rounds, cpus[0], cpus[1]) << " ns/往返" << endl;
+    }
+    return 0;
+}
+
+// Special Judge评测 (使用testlib.h的checker)
+// checker直接以argv启动，不经过shell；它不受题目的限制，只防止死循环和失控的内存占用
+// 用户输出在memfd user_fd中，checker继承该fd和测试数据的fd，通过/proc/self/fd打开
+JudgeResult special_judge(const string &spj_program, const TestPoint &point, int user_fd,
+                          Diagnostics &diagnostics) {
+    // testlib格式的checker通常接受三个参数：输入文件、用户输出、标准输出
+    // 或者四个参数：输入文件、用户输出、标准输出、结果文件
+    // 我们使用三个参数的格式
+    RunLimits limits;
+    limits.time_limit = 10000;
+    limits.wall_time_limit = 20000;
+    limits.memory_limit = 2048;
+    limits.process_limit = 64;
+    
+    TestData input, answer;
+    if (!input.open(point, false) || !answer.open(point, true)) {
+        return UKE;
+    }
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    int err_fd = create_capture("checker_stderr");
+    ChildProcess checker;
+    bool started = null_fd >= 0 && err_fd >= 0 &&
+                   spawn_program(spj_program, {input.path(), fd_path(user_fd), answer.path()},
+                                 null_fd, null_fd, err_fd, limits, checker,
+                                 {user_fd, input.fd(), answer.fd()});
+    if (null_fd >= 0) close(null_fd);
+    if (!started) {
+        if (err_fd >= 0) close(err_fd);
+        return UKE;
+    }
+    double time_used, wall_time_used;
+    long memory_used;
+    JudgeResult result = wait_program(checker, limits, time_used, wall_time_used, memory_used);
+    if (!input.finish() || !answer.finish()) {
+        diagnostics.report("SPJ错误: 测试数据解压失败");
+        close(err_fd);
+        return UKE;
+    }
+    
+    if ((result == AC || result == RE) && WIFEXITED(checker.status)) {
+        int exit_code = WEXITSTATUS(checker.status);
+        if (exit_code == 0 || exit_code == 1 || exit_code == 2) {
+            close(err_fd);
+            return (exit_code == 0) ? AC : WA;
+        }
+    }
+    // 读取可能的错误信息
+    report_program_error(diagnostics, "SPJ错误: ", err_fd);
+    close(err_fd);
+    return UKE;
+}
+
+// 测试点数据的完整内容：普通文件和解压好的memfd直接映射，任务包中的数据直接指向包的映射，
+// 边解压边读的管道读入内存
+class TestDataBuffer {
+public:
+    bool load(const TestPoint &point, bool answer) {
+        if (point.pack) {
+            const PackEntry &entry = *point.pack_entry;
+            pointer = point.pack->file.data() + (answer ? entry.output_offset : entry.input_offset);
+            length = answer ? entry.output_size : entry.input_size;
+            return true;
+        }
+        if (answer && point.answer) {
+            pointer = point.answer->data();
+            length = point.answer->size();
+            return true;
+        }
+        TestData source;
+        if (!source.open(point, answer)) {
+            return false;
+        }
+        if (!source.streaming()) {
+            if (!file.map(source.fd())) {
+                return false;
+            }
+            pointer = file.data();
+            length = file.size();
+            return source.finish();
+        }
+        char chunk[65536];
+        ssize_t n;
+        while ((n = read(source.fd(), chunk, sizeof(chunk))) > 0) {
+            buffer.append(chunk, n);
+        }
+        pointer = buffer.data();
+        length = buffer.size();
+        return n == 0 && source.finish();
+    }
+    
+    const char *data() const {
+        return pointer;
+    }
+    
+    size_t size() const {
+        return length;
+    }
+    
+private:
+    MappedFile file;
+    string buffer;
+    const char *pointer = "";
+    size_t length = 0;
+};
+
+// checker插件 (env中 是否为checker插件=1)：checker.cpp编译为共享库，导出
+//   extern "C" int check(const char *input, size_t input_size,
+//                        const char *user_output, size_t user_output_size,
+//                        const char *answer, size_t answer_size);
+// 三段数据都是内存中的完整内容，返回0为通过，1或2为答案错误 (与testlib的退出码相同)，其他值为评测错误
+// 每个任务dlopen一次，多个工作线程同时调用check，插件不能依赖可变的全局状态，也不能使用testlib.h
+class CheckerPlugin {
+public:
+    typedef int (*CheckFunction)(const char *, size_t, const char *, size_t, const char *, size_t);
+    
+    CheckerPlugin() {}
+    CheckerPlugin(const CheckerPlugin &) = delete;
+    CheckerPlugin &operator=(const CheckerPlugin &) = delete;
+    ~CheckerPlugin() {
+        if (handle != nullptr) {
+            dlclose(handle);
+        }
+    }
+    
+    bool load(const string &path, string &error) {
+        handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle == nullptr) {
+            error = dlerror();
+            return false;
+        }
+        check = (CheckFunction)dlsym(handle, "check");
+        if (check == nullptr) {
+            error = "没有导出 extern \"C\" int check(...)";
+            return false;
+        }
+        return true;
+    }
+    
+    CheckFunction check = nullptr;
+    
+private:
+    void *handle = nullptr;
+};
+
+// 用checker插件评测，user_fd为捕获学生程序 (或交互器) 输出的memfd，check直接在工作线程中调用
+JudgeResult plugin_judge(const CheckerPlugin &plugin, const TestPoint &point, int user_fd,
+                         Diagnostics &diagnostics) {
+    MappedFile user_output;
+    TestDataBuffer input, answer;
+    if (!user_output.map(user_fd) || !input.load(point, false) || !answer.load(point, true)) {
+        return UKE;
+    }
+    int code = plugin.check(input.data(), input.size(), user_output.data(), user_output.size(),
+                            answer.data(), answer.size());
+    if (code == 0) {
+        return AC;
+    } else if (code == 1 || code == 2) {
+        return WA;
+    }
+    diagnostics.report("SPJ错误: checker插件返回 " + to_string(code) + " (测试点 " + to_string(point.number) + ")");
+    return UKE;
+}
+
+// 隔离运行checker插件的辅助进程 (评测机以 --plugin-check 插件 输入 用户输出 标准输出 启动自身)
+// 新进程只有一个线程，加载插件后调用一次check，退出码就是check的返回值 (加载或读取失败时为3)
+int plugin_check_main(const string &plugin_path, const vector<string> &paths) {
+    CheckerPlugin plugin;
+    string error;
+    if (!plugin.load(plugin_path, error)) {
+        cerr << "checker插件加载失败: " << error << endl;
+        return 3;
+    }
+    // 普通文件和memfd直接映射，管道 (边解压边读的数据) 读入内存
+    MappedFile files[3];
+    string buffers[3];
+    const char *data[3];
+    size_t size[3];
+    for (int i = 0; i < 3; i++) {
+        struct stat st;
+        if (stat(paths[i].c_str(), &st) == 0 && S_ISREG(st.st_mode) && files[i].open(paths[i])) {
+            data[i] = files[i].data();
+            size[i] = files[i].size();
+            continue;
+        }
+        ifstream in(paths[i], ios::binary);
+        if (!in) {
+            cerr << "无法打开 " << paths[i] << endl;
+            return 3;
+        }
+        buffers[i].assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        data[i] = buffers[i].data();
+        size[i] = buffers[i].size();
+    }
+    return plugin.check(data[0], size[0], data[1], size[1], data[2], size[2]) & 0xFF;
+}
+
+// 隔离运行checker插件 (env中 checker插件隔离=1)：与独立的checker程序一样，每个测试点启动一个辅助进程，
+// 受相同的时间和内存限制，插件崩溃、死循环或占用过多内存只影响这一个测试点
+JudgeResult isolated_plugin_judge(const string &plugin_path, const TestPoint &point, int user_fd,
+                                  Diagnostics &diagnostics) {
+    RunLimits limits;
+    limits.time_limit = 10000;
+    limits.wall_time_limit = 20000;
+    limits.memory_limit = 2048;
+    limits.process_limit = 64;
+    
+    TestData input, answer;
+    if (!input.open(point, false) || !answer.open(point, true)) {
+        return UKE;
+    }
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    int err_fd = create_capture("checker_stderr");
+    ChildProcess helper;
+    bool started = null_fd >= 0 && err_fd >= 0 &&
+                   spawn_program("/proc/self/exe",
+                                 {"--plugin-check", plugin_path, input.path(), fd_path(user_fd), answer.path()},
+                                 null_fd, null_fd, err_fd, limits, helper, {user_fd, input.fd(), answer.fd()});
+    if (null_fd >= 0) close(null_fd);
+    if (!started) {
+        if (err_fd >= 0) close(err_fd);
+        return UKE;
+    }
+    double time_used, wall_time_used;
+    long memory_used;
+    JudgeResult result = wait_program(helper, limits, time_used, wall_time_used, memory_used);
+    if (!input.finish() || !answer.finish()) {
+        diagnostics.report("SPJ错误: 测试数据解压失败");
+        close(err_fd);
+        return UKE;
+    }
+    
+    if ((result == AC || result == RE) && WIFEXITED(helper.status)) {
+        int code = WEXITSTATUS(helper.status);
+        if (code == 0 || code == 1 || code == 2) {
+            close(err_fd);
+            return (code == 0) ? AC : WA;
+        }
+        diagnostics.report("SPJ错误: checker插件返回 " + to_string(code) + " (测试点 " + to_string(point.number) + ")");
+    } else {
+        bool timeout = result == TLE || (WIFSIGNALED(helper.status) && WTERMSIG(helper.status) == SIGXCPU);
+        diagnostics.report(string("SPJ错误: checker插件") +
+                           (timeout ? "超时" : result == MLE ? "超出内存限制" : "崩溃") +
+                           " (测试点 " + to_string(point.number) + ")");
+    }
+    report_program_error(diagnostics, "SPJ错误: ", err_fd);
+    close(err_fd);
+    return UKE;
+}
+
+// 常驻checker进程池 (env中 checker常驻进程数=N)
+// checker程序带有CHECKER_WORKER_SOURCE的外壳，每个进程依次处理多个测试点，不再为每个测试点exec checker；
+// 进程在第一次需要时启动，最多N个，工作线程取一个空闲进程，把测试点的fd发过去后等待退出码
+// 检查超时或进程崩溃时杀死该进程，下次需要时再启动新的
+// PR_SET_PDEATHSIG跟随创建子进程的线程，工作线程 (和常驻模式的连接线程) 结束时由它启动的进程会被杀死，
+// 所以常驻checker进程统一由进程池自己的线程启动
+class CheckerWorkers {
+public:
+    CheckerWorkers(const string &program, int count) : program(program), count(count) {}
+    CheckerWorkers(const CheckerWorkers &) = delete;
+    CheckerWorkers &operator=(const CheckerWorkers &) = delete;
+    
+    ~CheckerWorkers() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+            cv.notify_all();
+        }
+        if (launcher.joinable()) {
+            launcher.join();
+        }
+        for (auto &worker : idle) {
+            stop(*worker);
+        }
+    }
+    
+    bool matches(const string &other_program, int other_count) const {
+        return program == other_program && count == other_count;
+    }
+    
+    JudgeResult check(const TestPoint &point, int user_fd, Diagnostics &diagnostics) {
+        TestData input, answer;
+        if (!input.open(point, false) || !answer.open(point, true)) {
+            return UKE;
+        }
+        unique_ptr<Worker> worker = acquire();
+        if (!worker) {
+            return UKE;
+        }
+        int err_fd = create_capture("checker_stderr");
+        int code = -1;
+        bool healthy = err_fd >= 0 && request(*worker, {input.fd(), user_fd, answer.fd(), err_fd}, code);
+        release(move(worker), healthy);
+        if (!input.finish() || !answer.finish()) {
+            diagnostics.report("SPJ错误: 测试数据解压失败");
+            if (err_fd >= 0) close(err_fd);
+            return UKE;
+        }
+        if (err_fd < 0) {
+            return UKE;
+        }
+        if (code == 0 || code == 1 || code == 2) {
+            close(err_fd);
+            return (code == 0) ? AC : WA;
+        }
+        if (!healthy) {
+            diagnostics.report("SPJ错误: 常驻checker进程异常退出或超时 (测试点 " + to_string(point.number) + ")");
+        }
+        report_program_error(diagnostics, "SPJ错误: ", err_fd);
+        close(err_fd);
+        return UKE;
+    }
+    
+private:
+    struct Worker {
+        int socket_fd = -1;
+        ChildProcess process;
+        bool launched = false;      // 进程池的线程已处理启动请求 (不论成败)
+    };
+    
+    // 与单独运行的checker相同的限制；常驻进程的累计CPU时间不限制，
+    // 每次检查的子进程由外壳设置RLIMIT_CPU，另有墙钟超时兜底
+    static RunLimits worker_limits() {
+        RunLimits limits;
+        limits.time_limit = INT_MAX / 2;
+        limits.wall_time_limit = 20000;
+        limits.memory_limit = 2048;
+        limits.process_limit = 64;
+        return limits;
+    }
+    
+    unique_ptr<Worker> acquire() {
+        unique_lock<mutex> lock(mtx);
+        cv.wait(lock, [&] { return !idle.empty() || started < count; });  // 与启动请求共用条件变量
+        if (!idle.empty()) {
+            unique_ptr<Worker> worker = move(idle.back());
+            idle.pop_back();
+            return worker;
+        }
+        started++;
+        lock.unlock();
+        unique_ptr<Worker> worker(new Worker);
+        if (!start(*worker)) {
+            release(move(worker), false);
+            return nullptr;
+        }
+        return worker;
+    }
+    
+    void release(unique_ptr<Worker> worker, bool healthy) {
+        if (!healthy) {
+            stop(*worker);
+        }
+        lock_guard<mutex> lock(mtx);
+        if (healthy) {
+            idle.push_back(move(worker));
+        } else {
+            started--;
+        }
+        cv.notify_all();
+    }
+    
+    // 请进程池的线程启动worker并等待结果
+    bool start(Worker &worker) {
+        unique_lock<mutex> lock(mtx);
+        if (!launcher.joinable()) {
+            launcher = thread(&CheckerWorkers::launch_loop, this);
+        }
+        pending.push_back(&worker);
+        cv.notify_all();
+        cv.wait(lock, [&] { return worker.launched; });
+        return worker.socket_fd >= 0;
+    }
+    
+    void launch_loop() {
+        unique_lock<mutex> lock(mtx);
+        for (;;) {
+            cv.wait(lock, [&] { return stopping || !pending.empty(); });
+            if (stopping) {
+                return;
+            }
+            Worker *worker = pending.front();
+            pending.pop_front();
+            lock.unlock();
+            spawn(*worker);
+            lock.lock();
+            worker->launched = true;
+            cv.notify_all();
+        }
+    }
+    
+    void spawn(Worker &worker) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+            return;
+        }
+        int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+        bool started = null_fd >= 0 &&
+                       spawn_program(program, {}, sv[1], null_fd, null_fd, worker_limits(), worker.process);
+        if (null_fd >= 0) close(null_fd);
+        close(sv[1]);
+        if (!started) {
+            close(sv[0]);
+            return;
+        }
+        worker.socket_fd = sv[0];
+    }
+    
+    // 关闭socket让进程自行退出；超时或出错时直接杀死
+    static void stop(Worker &worker, bool kill_first = false) {
+        if (worker.process.pid > 0 && kill_first) {
+            kill(worker.process.pid, SIGKILL);
+        }
+        if (worker.socket_fd >= 0) {
+            close(worker.socket_fd);
+            worker.socket_fd = -1;
+        }
+        if (worker.process.pid > 0) {
+            waitpid(worker.process.pid, nullptr, 0);
+            worker.process.pid = -1;
+        }
+        if (!worker.process.cgroup_path.empty()) {
+            cgroup_destroy(worker.process.cgroup_path);
+            worker.process.cgroup_path.clear();
+        }
+    }
+    
+    // 发送一个测试点的四个fd并等待退出码，进程没有在墙钟时间限制内回复时杀死它
+    bool request(Worker &worker, const vector<int> &fds, int &code) {
+        char control[CMSG_SPACE(4 * sizeof(int))];
+        memset(control, 0, sizeof(control));
+        char byte = 0;
+        iovec iov = {&byte, 1};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(4 * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds.data(), 4 * sizeof(int));
+        if (sendmsg(worker.socket_fd, &msg, MSG_NOSIGNAL) != 1) {
+            return false;
+        }
+        
+        pollfd pfd = {worker.socket_fd, POLLIN, 0};
+        int ready;
+        do {
+            ready = poll(&pfd, 1, worker_limits().wall_time_limit);
+        } while (ready < 0 && errno == EINTR);
+        if (ready <= 0) {
+            stop(worker, true);
+            return false;
+        }
+        ssize_t n;
+        do {
+            n = read(worker.socket_fd, &code, sizeof(code));
+        } while (n < 0 && errno == EINTR);
+        return n == sizeof(code);
+    }
+    
+    string program;
+    int count;
+    mutex mtx;
+    condition_variable cv;
+    vector<unique_ptr<Worker>> idle;
+    int started = 0;                // 已启动 (空闲或正在检查) 的进程数
+    thread launcher;                // 启动常驻进程的线程，第一次需要时创建
+    deque<Worker *> pending;        // 等待启动的worker
+    bool stopping = false;
+};
+
+// 一次评测共用的配置、限制和程序路径
+struct JudgeContext {
+    Config config;
+    Options options;
+    RunLimits limits;
+    string student_exe;
+    string checker_exe;
+    string interactor_exe;
+    string manager_exe;
+    string launcher_exe;            // zygote启动器，为空表示不使用zygote
+    shared_ptr<CheckerPlugin> checker_plugin;  // 已加载的checker插件，为空表示checker是独立程序
+    shared_ptr<CheckerWorkers> checker_workers;  // 常驻checker进程池，为空表示每个测试点启动一次checker
+    string result_key;              // 结果缓存键中各测试点共用的部分，为空表示不使用结果缓存
+    Diagnostics *diagnostics = nullptr;  // 本次评测的诊断信息输出
+};
+
+// 运行Special Judge：checker插件 (在评测进程中或隔离运行)、常驻checker进程或独立的checker程序
+JudgeResult run_checker(const JudgeContext &ctx, const TestPoint &point, int user_fd) {
+    if (ctx.checker_plugin) {
+        return plugin_judge(*ctx.checker_plugin, point, user_fd, *ctx.diagnostics);
+    }
+    if (ctx.config.checker_plugin) {
+        return isolated_plugin_judge(ctx.checker_exe, point, user_fd, *ctx.diagnostics);
+    }
+    if (ctx.checker_workers) {
+        return ctx.checker_workers->check(point, user_fd, *ctx.diagnostics);
+    }
+    return special_judge(ctx.checker_exe, point, user_fd, *ctx.diagnostics);
+}
+
+// 常驻模式下缓存的标准输出映射，文件被替换 (设备号、inode不同) 或修改 (mtime、大小不同) 时重新映射
+struct CachedAnswer {
+    dev_t dev = 0;
+    ino_t ino = 0;
+    timespec mtime = {0, 0};
+    off_t size = -1;
+    shared_ptr<MappedFile> file;
+};
+
+// 常驻模式下缓存的题目程序 (checker/interactor)，源文件未修改时复用上次编译的结果
+struct CachedProgram {
+    string prefix;                  // 路径前缀，每次重新编译换一个新文件
+    string exe;                     // 当前路径，正在运行的旧程序不受重新编译影响
+    unsigned long generation = 0;
+    bool built = false;
+    timespec mtime = {0, 0};
+};
+
+// 测试点运行时间记录：只在多线程评测时使用，放在编译缓存目录中 (history-<题目绝对路径的SHA-256>)，
+// 与其他缓存项一起按LRU淘汰；不使用编译缓存时不记录，题目目录保持只读
+// 每行为 "测试点编号 墙钟时间(ms)"，保存每个测试点最近一次实际运行的墙钟时间，用来安排多线程评测的顺序
+// 读写都用flock与同时评测这道题的其他评测机互斥
+string history_path(const string &cache_dir, const string &task_path) {
+    if (cache_dir.empty()) {
+        return "";
+    }
+    char *resolved = realpath(task_path.c_str(), nullptr);
+    Sha256 hash;
+    hash.update(resolved != nullptr ? string(resolved) : task_path);
+    free(resolved);
+    return cache_dir + "/history-" + hash.hex_digest();
+}
+
+map<int, double> parse_history(int fd) {
+    map<int, double> history;
+    string content;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        content.append(buffer, n);
+    }
+    istringstream lines(content);
+    string line;
+    while (getline(lines, line)) {
+        istringstream fields(line);
+        int number;
+        double wall_ms;
+        if (fields >> number >> wall_ms && wall_ms >= 0) {
+            history[number] = wall_ms;
+        }
+    }
+    return history;
+}
+
+map<int, double> read_history(const string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return map<int, double>();
+    }
+    flock(fd, LOCK_SH);
+    map<int, double> history = parse_history(fd);
+    close(fd);
+    return history;
+}
+
+// 把这次实际运行过的测试点的墙钟时间合并进记录；跳过的、评测错误的和结果来自缓存的测试点保留原记录
+void update_history(const string &path, const vector<TestPoint> &points) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    map<int, double> history = parse_history(fd);
+    for (const auto &point : points) {
+        if (point.number >= 0 && !point.cached_run && point.result != SKIPPED && point.result != UKE) {
+            history[point.number] = point.wall_time_used;
+        }
+    }
+    string content;
+    for (const auto &entry : history) {
+        content += to_string(entry.first) + " " + to_string(entry.second) + "\n";
+    }
+    if (ftruncate(fd, 0) == 0) {
+        ssize_t written = pwrite(fd, content.data(), content.size(), 0);
+        (void)written;
+    }
+    close(fd);
+}
+
+// 多线程评测时测试点的领取顺序：预计最慢的先运行，避免最后只剩一个大测试点在跑
+// 没有记录的测试点 (新题或新加的测试点) 排在最前面，其中输入大的先运行；其余按记录的墙钟时间从长到短
+vector<size_t> schedule_points(const vector<TestPoint> &points, const map<int, double> &history) {
+    struct Estimate {
+        bool known;
+        double wall_ms;
+        long long input_size;
+    };
+    vector<Estimate> estimates;
+    for (const auto &point : points) {
+        Estimate estimate = {false, 0, 0};
+        auto it = history.find(point.number);
+        if (it != history.end()) {
+            estimate.known = true;
+            estimate.wall_ms = it->second;
+        }
+        struct stat st;
+        if (point.pack) {
+            estimate.input_size = point.pack_entry->input_size;
+        } else if (stat(point.input_file.c_str(), &st) == 0) {
+            estimate.input_size = st.st_size;
+        }
+        estimates.push_back(estimate);
+    }
+    vector<size_t> order(points.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        const Estimate &x = estimates[a], &y = estimates[b];
+        if (x.known != y.known) return !x.known;
+        if (x.known && x.wall_ms != y.wall_ms) return x.wall_ms > y.wall_ms;
+        return x.input_size > y.input_size;
+    });
+    return order;
+}
+
+// 常驻模式下按题目目录缓存的数据，env或目录被修改后重新加载
+// 同一题目的并发评测通过lock串行地检查和更新缓存，运行测试点时不持有锁
+struct TaskCache {
+    mutex lock;
+    bool loaded = false;
+    timespec env_mtime = {0, 0};
+    timespec dir_mtime = {0, 0};
+    Config config;
+    vector<TestPoint> test_points;              // 测试点列表 (结果字段未填写)
+    CachedProgram checker;
+    CachedProgram checker_plugin;
+    CachedProgram checker_worker;
+    CachedProgram interactor;
+    CachedProgram manager;
+    map<string, CachedAnswer> answers;          // 标准输出映射，按输出文件路径索引
+    shared_ptr<CheckerWorkers> checker_workers;  // 常驻checker进程，checker重新编译后换新
+    unsigned long last_used = 0;
+};
+
+// 由交互器 (或通信题的管理器) 的退出状态和学生程序的结果给出测试点结果
+// 学生程序超时、超内存或输出超限时优先判定；退出码0通过，1/2答案错误，其余为评测错误
+JudgeResult controller_verdict(JudgeResult controller_result, int status, JudgeResult student_result) {
+    if (student_result == TLE || student_result == MLE || student_result == OLE) {
+        return student_result;
+    }
+    JudgeResult result;
+    if (controller_result == AC || (controller_result == RE && WIFEXITED(status))) {
+        int exit_code = WEXITSTATUS(status);
+        if (exit_code == 1 || exit_code == 2) {
+            // 学生程序可能因交互器提前退出而收到SIGPIPE，以交互器的结论为准
+            return WA;
+        }
+        result = (exit_code == 0) ? AC : UKE;
+    } else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE && student_result == AC) {
+        // 学生程序提前退出，交互器写入时管道已关闭
+        return WA;
+    } else {
+        result = UKE;
+    }
+    return (student_result != AC) ? student_result : result;
+}
+
+// 交互题评测：学生程序和交互器通过两个管道相连，交互器的标准输出就是学生程序的标准输入
+// 交互器按testlib格式以 interactor <输入文件> <输出文件> <标准输出> 运行，
+// 退出码给出结果：0通过，1/2答案错误，其余为评测错误；学生程序超时或超内存时优先判定
+// 两个进程都受时间和内存限制，交互器的CPU时间限制为墙钟时间限制 (它大部分时间在等待学生程序)，
+// 墙钟时间限制多留1秒，双方互相等待时先超时的是学生程序
+// cpu不为-1时两个进程绑定到同一个CPU，每次往返只是同一个核上的两次切换，不需要跨核唤醒
+JudgeResult interactive_judge(const JudgeContext &ctx, TestPoint &point, const string &work_dir, int cpu) {
+    RunLimits student_limits = ctx.limits;
+    student_limits.cpu = cpu;
+    RunLimits interactor_limits = student_limits;
+    interactor_limits.time_limit = ctx.limits.wall_time_limit;
+    interactor_limits.wall_time_limit = ctx.limits.wall_time_limit + 1000;
+    interactor_limits.memory_limit = max(ctx.limits.memory_limit, 256);
+    
+    int to_student[2], from_student[2];
+    if (pipe2(to_student, O_CLOEXEC) != 0) {
+        return UKE;
+    }
+    if (pipe2(from_student, O_CLOEXEC) != 0) {
+        close(to_student[0]);
+        close(to_student[1]);
+        return UKE;
+    }
+    // 交互器的输出文件和双方的标准错误都捕获到memfd中
+    int student_err = create_capture("student_stderr");
+    int interactor_err = create_capture("interactor_stderr");
+    int interactor_out = create_capture("interactor_output");
+    
+    // 先启动交互器，学生程序的第一次读取不必等它启动
+    ChildProcess interactor, student;
+    TestData input, answer;
+    bool data_opened = input.open(point, false) && answer.open(point, true);
+    vector<string> interactor_args = {input.path(), fd_path(interactor_out), answer.path()};
+    bool interactor_started = data_opened && interactor_err >= 0 && student_err >= 0 && interactor_out >= 0 &&
+        spawn_program(ctx.interactor_exe, interactor_args, from_student[0], to_student[1],
+                      interactor_err, interactor_limits, interactor,
+                      {interactor_out, input.fd(), answer.fd()});
+    bool student_started = interactor_started &&
+        spawn_program(ctx.student_exe, vector<string>(), to_student[0], from_student[1],
+                      student_err, student_limits, student, vector<int>(), work_dir);
+    // 父进程必须关闭所有管道端，否则一方退出后另一方读不到EOF
+    for (int fd : {to_student[0], to_student[1], from_student[0], from_student[1], student_err}) {
+        if (fd >= 0) close(fd);
+    }
+    if (!interactor_started) {
+        for (int fd : {interactor_err, interactor_out}) {
+            if (fd >= 0) close(fd);
+        }
+        return UKE;
+    }
+    // 两个进程同时受监视，任何一方超时都立即被杀死
+    watch_program(interactor, interactor_limits);
+    if (student_started) {
+        watch_program(student, student_limits);
+    }
+    
+    JudgeResult student_result = UKE;
+    if (student_started) {
+        student_result = wait_program(student, student_limits, point.time_used,
+                                      point.wall_time_used, point.memory_used);
+    }
+    double interactor_time, interactor_wall;
+    long interactor_memory;
+    JudgeResult interactor_result = wait_program(interactor, interactor_limits, interactor_time,
+                                                 interactor_wall, interactor_memory);
+    
+    JudgeResult result = controller_verdict(interactor_result, interactor.status, student_result);
+    if (result == UKE && student_result == AC) {
+        report_program_error(*ctx.diagnostics, "交互器错误: ", interactor_err);
+    } else if (result == AC && ctx.config.special_judge) {
+        // 交互器写出的输出文件再交给checker检查
+        result = run_checker(ctx, point, interactor_out);
+    }
+    close(interactor_err);
+    close(interactor_out);
+    return result;
+}
+
+// 通信题评测：管理器启动后，同时运行config.communication_processes个学生程序实例，
+// 每个实例的标准输入/输出各通过一个管道连到管理器，由管理器在实例之间转发消息
+// 管理器按 manager <输入文件> <输出文件> <标准输出> <实例数> <写fd0> <读fd0> <写fd1> <读fd1> ... 运行，
+// 写fdi接实例i的标准输入，读fdi接实例i的标准输出；实例以自己的编号作为第一个参数运行
+// 每个实例各自计时和限制资源 (独立的cgroup/rusage)，测试点报告各实例中的最大值
+JudgeResult communication_judge(const JudgeContext &ctx, TestPoint &point, const string &work_dir) {
+    int instances = max(1, ctx.config.communication_processes);
+    RunLimits manager_limits = ctx.limits;
+    manager_limits.time_limit = ctx.limits.wall_time_limit;
+    manager_limits.wall_time_limit = ctx.limits.wall_time_limit + 1000;
+    manager_limits.memory_limit = max(ctx.limits.memory_limit, 256);
+    
+    // to_student[i]/from_student[i]: 管理器写入/读出实例i的管道
+    vector<int> fds;
+    vector<array<int, 2>> to_student(instances, {{-1, -1}}), from_student(instances, {{-1, -1}});
+    bool ok = true;
+    for (int i = 0; i < instances && ok; i++) {
+        ok = pipe2(to_student[i].data(), O_CLOEXEC) == 0;
+        if (ok) {
+            fds.insert(fds.end(), to_student[i].begin(), to_student[i].end());
+            ok = pipe2(from_student[i].data(), O_CLOEXEC) == 0;
+        }
+        if (ok) {
+            fds.insert(fds.end(), from_student[i].begin(), from_student[i].end());
+            // 加大管道缓冲区，一次传递大块数据的实例不会因管理器暂时没读而阻塞
+            fcntl(to_student[i][1], F_SETPIPE_SZ, 1 << 20);
+            fcntl(from_student[i][1], F_SETPIPE_SZ, 1 << 20);
+        }
+    }
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    int manager_err = create_capture("manager_stderr");
+    int manager_out = create_capture("manager_output");
+    fds.push_back(null_fd);
+    TestData input, answer;
+    ok = ok && null_fd >= 0 && manager_err >= 0 && manager_out >= 0 &&
+         input.open(point, false) && answer.open(point, true);
+    
+    ChildProcess manager;
+    vector<ChildProcess> students(instances);
+    vector<bool> started(instances, false);
+    if (ok) {
+        vector<int> manager_fds = {manager_out, input.fd(), answer.fd()};
+        vector<string> args = {input.path(), fd_path(manager_out), answer.path(), to_string(instances)};
+        for (int i = 0; i < instances; i++) {
+            args.push_back(to_string(to_student[i][1]));
+            args.push_back(to_string(from_student[i][0]));
+            manager_fds.push_back(to_student[i][1]);
+            manager_fds.push_back(from_student[i][0]);
+        }
+        ok = spawn_program(ctx.manager_exe, args, null_fd, null_fd, manager_err, manager_limits,
+                           manager, manager_fds);
+    }
+    if (ok) {
+        // 所有实例的标准错误写到同一个memfd
+        int student_err = create_capture("student_stderr");
+        for (int i = 0; i < instances && student_err >= 0; i++) {
+            started[i] = spawn_program(ctx.student_exe, {to_string(i)}, to_student[i][0],
+                                       from_student[i][1], student_err, ctx.limits, students[i],
+                                       vector<int>(), work_dir);
+        }
+        if (student_err >= 0) close(student_err);
+    }
+    // 父进程必须关闭所有管道端，否则一方退出后另一方读不到EOF
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+    if (!ok) {
+        for (int fd : {manager_err, manager_out}) {
+            if (fd >= 0) close(fd);
+        }
+        return UKE;
+    }
+    watch_program(manager, manager_limits);
+    for (int i = 0; i < instances; i++) {
+        if (started[i]) watch_program(students[i], ctx.limits);
+    }
+    
+    // 汇总各实例的结果：超时/超内存/输出超限优先，其次是其他错误
+    JudgeResult student_result = AC;
+    point.time_used = point.wall_time_used = 0;
+    point.memory_used = 0;
+    for (int i = 0; i < instances; i++) {
+        JudgeResult result = UKE;
+        double time_used = 0, wall_time_used = 0;
+        long memory_used = 0;
+        if (started[i]) {
+            result = wait_program(students[i], ctx.limits, time_used, wall_time_used, memory_used);
+        }
+        point.time_used = max(point.time_used, time_used);
+        point.wall_time_used = max(point.wall_time_used, wall_time_used);
+        point.memory_used = max(point.memory_used, memory_used);
+        if (result == TLE || result == MLE || result == OLE) {
+            if (student_result != TLE && student_result != MLE && student_result != OLE) {
+                student_result = result;
+            }
+        } else if (result != AC && student_result == AC) {
+            student_result = result;
+        }
+    }
+    double manager_time, manager_wall;
+    long manager_memory;
+    JudgeResult manager_result = wait_program(manager, manager_limits, manager_time,
+                                              manager_wall, manager_memory);
+    
+    JudgeResult result = controller_verdict(manager_result, manager.status, student_result);
+    if (result == UKE && student_result == AC) {
+        report_program_error(*ctx.diagnostics, "管理器错误: ", manager_err);
+    } else if (result == AC && ctx.config.special_judge) {
+        result = run_checker(ctx, point, manager_out);
+    }
+    close(manager_err);
+    close(manager_out);
+    return result;
+}
+
+// 与压缩的标准输出比对：输入缓存中有解压好的memfd时直接映射；否则文本比较用流式比对器边解压边比较，
+// 其他比较方式读入全部解压结果后比较
+JudgeResult compressed_judge(const Config &config, const TestPoint &point, const MappedFile &user_output,
+                             CompareDiff *diff, Diagnostics &diagnostics) {
+    TestData answer;
+    if (!answer.open(point, true)) {
+        return UKE;
+    }
+    JudgeResult result;
+    if (!answer.streaming()) {
+        MappedFile std_file;
+        result = !std_file.map(answer.fd()) ? UKE :
+                 compare_output(config, std_file.data(), std_file.size(),
+                                user_output.data(), user_output.size(), diff);
+    } else if (config.comparator != TEXT_COMPARE) {
+        string expected;
+        char buffer[65536];
+        ssize_t n;
+        while ((n = read(answer.fd(), buffer, sizeof(buffer))) > 0) {
+            expected.append(buffer, n);
+        }
+        result = (n < 0) ? UKE : compare_output(config, expected.data(), expected.size(),
+                                                user_output.data(), user_output.size(), diff);
+    } else {
+        StreamComparator comparator;
+        if (!comparator.open(answer.path())) {
+            return UKE;
+        }
+        comparator.feed(user_output.data(), user_output.size());
+        result = comparator.finish();
+        if (result == WA && diff != nullptr) {
+            *diff = comparator.difference();
+        }
+    }
+    if (!answer.finish()) {
+        diagnostics.report("测试点 " + to_string(point.number) + ": 标准输出解压失败");
+        return UKE;
+    }
+    return result;
+}
+
+// 输入文件 (压缩的文件按解压后的内容) 的SHA-256摘要，避免每次运行都重新读取整个输入文件
+// 以 (dev, ino, 大小, mtime) 确认文件没有修改，与InputCache的判断相同；摘要记在进程内的表中，
+// 并以digest-前缀存入缓存目录 (随其他缓存项按LRU淘汰)，重新启动的评测进程也不必重新计算
+// 整个评测进程 (包括常驻模式的所有连接) 共用，进程退出前不销毁
+class InputDigests {
+public:
+    static InputDigests &instance() {
+        static InputDigests *digests = new InputDigests();
+        return *digests;
+    }
+    
+    // 取point的输入数据的摘要，读取失败时返回false
+    bool get(const TestPoint &point, const string &cache_dir, unsigned char digest[32]) {
+        struct stat st;
+        if (stat(point.input_file.c_str(), &st) != 0) {
+            return false;
+        }
+        string key = point.input_file + '\0' + to_string(st.st_dev) + " " + to_string(st.st_ino) + " " +
+                     to_string(st.st_size) + " " + to_string(st.st_mtim.tv_sec) + "." +
+                     to_string(st.st_mtim.tv_nsec);
+        {
+            lock_guard<mutex> guard(lock);
+            auto it = digests.find(key);
+            if (it != digests.end()) {
+                memcpy(digest, it->second.data(), 32);
+                return true;
+            }
+        }
+        
+        // 计算时不持有锁，同一个文件可能被两个线程同时计算，结果相同
+        string entry;
+        if (!cache_dir.empty()) {
+            Sha256 name;
+            name.update(key);
+            entry = cache_dir + "/digest-" + name.hex_digest();
+        }
+        if (entry.empty() || !load(entry, digest)) {
+            TestData input;
+            if (!input.open(point, false) || append_hashed(-1, input, digest) < 0) {
+                return false;
+            }
+            if (!entry.empty()) {
+                cache_store_data(cache_dir, entry, (const char *)digest, 32);
+            }
+        }
+        lock_guard<mutex> guard(lock);
+        digests[key] = string((const char *)digest, 32);
+        return true;
+    }
+    
+private:
+    InputDigests() {}
+    
+    // 读取缓存目录中的摘要，命中时刷新mtime作为LRU时间
+    static bool load(const string &entry, unsigned char digest[32]) {
+        int fd = open(entry.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = read(fd, digest, 32) == 32;
+        close(fd);
+        if (ok) {
+            utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+        }
+        return ok;
+    }
+    
+    mutex lock;
+    map<string, string> digests;    // 文件路径和状态 -> 摘要
+};
+
+// 结果缓存 (env中 结果缓存=1)：以 学生程序 + 输入数据 + 资源限制 + 评测机版本 的SHA-256为键，
+// 记录学生程序自身的运行结果 (判定前)、用时、内存和输出的哈希；输出按哈希另存一份，相同的输出只存一次
+// 修改标准输出、checker或env中的分值后重测时，键不变的测试点不再运行，取出缓存的输出重新判定
+// 缓存项放在编译缓存目录中，与编译结果一起按LRU淘汰；假定学生程序的输出是确定的
+string result_cache_entry(const JudgeContext &ctx, const TestPoint &point) {
+    // 输入数据取解压后内容的SHA-256摘要参与计算，与任务包中记录的哈希相同，打包前后缓存仍然有效
+    unsigned char input_hash[32];
+    if (point.pack) {
+        memcpy(input_hash, point.pack_entry->input_hash, sizeof(input_hash));
+    } else if (!InputDigests::instance().get(point, ctx.options.cache_dir, input_hash)) {
+        return "";
+    }
+    Sha256 hash;
+    hash.update(ctx.result_key);
+    hash.update(input_hash, sizeof(input_hash));
+    return ctx.options.cache_dir + "/result-" + hash.hex_digest();
+}
+
+// 取出缓存的运行结果，运行正常结束时output_fd为缓存的输出；命中时刷新mtime作为LRU时间
+bool result_cache_fetch(const string &cache_dir, const string &entry, TestPoint &point, int &output_fd) {
+    ifstream file(entry);
+    int result;
+    double time_used, wall_time_used;
+    long memory_used;
+    string output_hash;
+    if (!(file >> result >> time_used >> wall_time_used >> memory_used >> output_hash) ||
+        !(result == AC || result == MLE || result == OLE || result == RE)) {
+        return false;
+    }
+    if (result == AC) {
+        string output = cache_dir + "/output-" + output_hash;
+        output_fd = open(output.c_str(), O_RDONLY | O_CLOEXEC);
+        if (output_fd < 0) {
+            return false;  // 输出已被淘汰
+        }
+        utimensat(AT_FDCWD, output.c_str(), nullptr, 0);
+    }
+    utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+    point.result = (JudgeResult)result;
+    point.time_used = time_used;
+    point.wall_time_used = wall_time_used;
+    point.memory_used = memory_used;
+    return true;
+}
+
+// 只缓存由学生程序自身决定的运行结果：正常结束、超出内存或输出限制、非零退出码和程序自己触发的信号
+// 超时 (可能只是机器繁忙)、评测错误以及从外部发来的信号 (SIGKILL、SIGTERM等) 重测时可能不同，不缓存
+bool result_cacheable(JudgeResult result, int status) {
+    if (result == AC || result == MLE || result == OLE) {
+        return true;
+    }
+    if (result != RE) {
+        return false;
+    }
+    if (WIFEXITED(status)) {
+        return true;
+    }
+    if (!WIFSIGNALED(status)) {
+        return false;
+    }
+    int sig = WTERMSIG(status);
+    return sig == SIGSEGV || sig == SIGABRT || sig == SIGFPE || sig == SIGBUS || sig == SIGILL ||
+           sig == SIGTRAP || sig == SIGSYS;
+}
+
+// 记录运行结果，正常结束时同时存入输出
+void result_cache_store(const string &cache_dir, const string &entry, const TestPoint &point,
+                        const MappedFile &user_output) {
+    string output_hash = "-";
+    if (point.result == AC) {
+        Sha256 hash;
+        hash.update(user_output.data(), user_output.size());
+        output_hash = hash.hex_digest();
+        string output = cache_dir + "/output-" + output_hash;
+        if (utimensat(AT_FDCWD, output.c_str(), nullptr, 0) != 0) {
+            cache_store_data(cache_dir, output, user_output.data(), user_output.size());
+        }
+    }
+    string record = to_string((int)point.result) + " " + to_string(point.time_used) + " " +
+                    to_string(point.wall_time_used) + " " + to_string(point.memory_used) + " " +
+                    output_hash + "\n";
+    cache_store_data(cache_dir, entry, record.data(), record.size());
+}
+
+// 判定学生程序的输出：检查输出大小，再用checker或比较器与标准输出比对
+// point.result为学生程序的运行结果，不是AC时保持不变
+void judge_output(const JudgeContext &ctx, TestPoint &point, int output_fd, const MappedFile &user_output) {
+    // 捕获了信号SIGXFSZ的程序写满限制后仍可能正常退出
+    if (point.result == AC && ctx.limits.output_limit > 0 &&
+        user_output.size() >= (size_t)ctx.limits.output_limit * 1024 * 1024) {
+        point.result = OLE;
+    }
+    if (point.result == AC) {
+        if (ctx.config.special_judge) {
+            point.result = run_checker(ctx, point, output_fd);
+        } else if (point.pack) {
+            // 标准输出直接在任务包的映射中比较
+            const PackEntry &entry = *point.pack_entry;
+            point.result = compare_output(ctx.config, point.pack->file.data() + entry.output_offset,
+                                          entry.output_size, user_output.data(), user_output.size(),
+                                          &point.diff);
+        } else if (decompressor_for(point.output_file) != nullptr) {
+            point.result = compressed_judge(ctx.config, point, user_output, &point.diff, *ctx.diagnostics);
+        } else {
+            // 常驻模式下使用缓存的标准输出映射
+            MappedFile std_file;
+            const MappedFile *expected = point.answer.get();
+            if (expected == nullptr) {
+                expected = std_file.open(point.output_file) ? &std_file : nullptr;
+            }
+            point.result = (expected == nullptr) ? UKE :
+                           compare_output(ctx.config, expected->data(), expected->size(),
+                                          user_output.data(), user_output.size(), &point.diff);
+        }
+    }
+}
+
+// 评测单个测试点，学生程序在工作线程自己的目录work_dir中运行
+// 标准输出和标准错误捕获到memfd，比对时直接映射，不经过文件系统
+// cpu为交互题绑定的CPU编号，-1表示不绑定；zygote为工作线程预先启动的启动器
+void judge_point(const JudgeContext &ctx, TestPoint &point, size_t index, const string &work_dir,
+                 int cpu = -1, Zygote *zygote = nullptr) {
+    if (ctx.config.communication) {
+        point.result = communication_judge(ctx, point, work_dir);
+        return;
+    }
+    if (ctx.config.interactive) {
+        point.result = interactive_judge(ctx, point, work_dir, cpu);
+        return;
+    }
+    
+    // 结果缓存命中时不运行学生程序，只重新判定
+    string cache_entry = ctx.result_key.empty() ? "" : result_cache_entry(ctx, point);
+    int cached_output = -1;
+    if (!cache_entry.empty() && result_cache_fetch(ctx.options.cache_dir, cache_entry, point, cached_output)) {
+        point.cached_run = true;
+        MappedFile user_output;
+        if (point.result == AC && !user_output.map(cached_output)) {
+            point.result = UKE;
+        }
+        judge_output(ctx, point, cached_output, user_output);
+        if (cached_output >= 0) close(cached_output);
+        return;
+    }
+    
+    int error_fd = create_capture("student_stderr");
+    TestData input;
+    if (error_fd < 0 || !input.open(point, false)) {
+        if (error_fd >= 0) close(error_fd);
+        point.result = UKE;
+        return;
+    }
+    
+    // 流式比对：输出经管道直接比较，第一处不一致就结束运行 (输出不完整，不使用结果缓存)
+    if (ctx.options.stream && !ctx.config.special_judge && ctx.config.comparator == TEXT_COMPARE &&
+        cache_entry.empty()) {
+        TestData answer;
+        {
+            // 比对器先于answer销毁，压缩的标准输出没读完时解压程序才能因管道关闭而结束
+            StreamComparator comparator;
+            point.result = !(answer.open(point, true) && comparator.open(answer.path())) ? UKE :
+                           run_program(ctx.student_exe, input.fd(), -1, error_fd, ctx.limits,
+                                       point.time_used, point.wall_time_used, point.memory_used,
+                                       &comparator, work_dir, zygote, ctx.launcher_exe);
+            close(error_fd);
+            if (point.result == AC) {
+                point.result = comparator.finish();
+            }
+            if (point.result == WA) {
+                point.diff = comparator.difference();
+            }
+        }
+        if (!input.finish() || !answer.finish()) {
+            ctx.diagnostics->report("测试点 " + to_string(point.number) + ": 测试数据解压失败");
+            point.result = UKE;
+        }
+        return;
+    }
+    
+    // 运行学生程序
+    int output_fd = create_capture(("student_out_" + to_string(index + 1)).c_str());
+    int status = 0;
+    point.result = (output_fd < 0) ? UKE :
+                   run_program(ctx.student_exe, input.fd(), output_fd, error_fd, ctx.limits,
+                               point.time_used, point.wall_time_used, point.memory_used,
+                               nullptr, work_dir, zygote, ctx.launcher_exe, &status);
+    close(error_fd);
+    if (!input.finish()) {
+        ctx.diagnostics->report("测试点 " + to_string(point.number) + ": 测试数据解压失败");
+        point.result = UKE;
+    }
+    
+    // 如果运行成功，进行评测
+    MappedFile user_output;
+    if (point.result == AC && !user_output.map(output_fd)) {
+        point.result = UKE;
+    }
+    if (!cache_entry.empty() && result_cacheable(point.result, status)) {
+        result_cache_store(ctx.options.cache_dir, cache_entry, point, user_output);
+    }
+    judge_output(ctx, point, output_fd, user_output);
+    if (output_fd >= 0) close(output_fd);
+}
+
+// 解析命令行参数，返回位置参数；option_args不为空时记录所有选项参数
+vector<string> parse_options(const vector<string> &argv, Options &options,
+                             vector<string> *option_args = nullptr) {
+    vector<string> args;
+    size_t option_start = 0;
+    for (size_t i = 0; i < argv.size(); i++) {
+        const string &arg = argv[i];
+        option_start = i;
+        bool has_value = i + 1 < argv.size();
+        if (arg == "-j" && has_value) {
+            options.jobs = atoi(argv[++i].c_str());
+        } else if (arg.size() > 2 && arg.compare(0, 2, "-j") == 0) {
+            options.jobs = atoi(arg.c_str() + 2);
+        } else if (arg == "--cgroup" && has_value) {
+            options.cgroup_dir = argv[++i];
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--cache-dir" && has_value) {
+            options.cache_dir = argv[++i];
+        } else if (arg == "--no-cache") {
+            options.cache_dir.clear();
+        } else if (arg == "--cache-size" && has_value) {
+            options.cache_size_mb = atoll(argv[++i].c_str());
+        } else if (arg == "--serve" && has_value) {
+            options.serve_socket = argv[++i];
+        } else if (arg == "--work-dir" && has_value) {
+            options.work_root = argv[++i];
+        } else if (arg == "--tmpfs") {
+            options.work_root = "/dev/shm";
+        } else if (arg == "--pin-cpu") {
+            options.pin_cpu = true;
+        } else if (arg == "--zygote") {
+            options.zygote = true;
+        } else if (arg == "--static") {
+            options.static_link = true;
+        } else if (arg == "--input-cache" && has_value) {
+            options.input_cache_mb = atoll(argv[++i].c_str());
+        } else {
+            args.push_back(arg);
+            continue;
+        }
+        if (option_args != nullptr) {
+            option_args->insert(option_args->end(), argv.begin() + option_start, argv.begin() + i + 1);
+        }
+    }
+    if (options.jobs <= 0) {
+        options.jobs = max(1u, thread::hardware_concurrency());
+    }
+    return args;
+}
+
+// 文件修改时间是否相同
+bool same_mtime(const timespec &a, const timespec &b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+// 评测一份提交，结果写到out，错误信息写到err，返回进程退出码
+// 所有临时文件都在options.work_root下的私有工作目录中，评测结束时删除
+// cache不为空时 (常驻模式) 复用其中的配置、测试点列表、checker和标准输出映射
+// task_path是题目目录或judge pack生成的任务包，任务包的checker等源文件在包所在的目录中
+int judge_submission(const string &student_cpp, const string &task_path, const Options &options,
+                     ostream &out, ostream &err, TaskCache *cache = nullptr) {
+    WorkDir work(options.work_root);
+    if (!work.valid()) {
+        err << "无法在 " << options.work_root << " 下创建工作目录: " << strerror(errno) << endl;
+        return 1;
+    }
+    
+    Diagnostics diagnostics(err);
+    JudgeContext ctx;
+    ctx.options = options;
+    ctx.diagnostics = &diagnostics;
+    ctx.student_exe = work.path() + "/student";
+    ctx.checker_exe = work.path() + "/checker";
+    ctx.interactor_exe = work.path() + "/interactor";
+    ctx.manager_exe = work.path() + "/manager";
+    
+    // 学生代码的编译与题目数据无关，最先开始
+    CompileJob student_job = start_compile(student_cpp, ctx.student_exe, options);
+    bool student_compiled = false;
+    auto student_failed = [&]() {
+        student_compiled = true;
+        if (finish_compile(student_job, options, out)) {
+            return false;
+        }
+        out << "学生代码编译失败" << endl;
+        out << "总分: 0" << endl;
+        return true;
+    };
+    
+    unique_lock<mutex> cache_lock;
+    if (cache != nullptr) {
+        cache_lock = unique_lock<mutex>(cache->lock);
+    }
+    
+    // 读取配置文件 (任务包中保存的env，这时用任务包自身的mtime判断缓存是否有效)
+    string task_dir = task_path;
+    string config_file = task_path + "/env";
+    struct stat env_stat, dir_stat;
+    bool packed = stat(task_path.c_str(), &env_stat) == 0 && S_ISREG(env_stat.st_mode);
+    if (packed) {
+        size_t slash = task_path.rfind('/');
+        task_dir = (slash == string::npos) ? "." : task_path.substr(0, max(slash, (size_t)1));
+        config_file = task_path;
+    }
+    bool cache_valid = cache != nullptr && cache->loaded &&
+                       stat(config_file.c_str(), &env_stat) == 0 &&
+                       stat(task_dir.c_str(), &dir_stat) == 0 &&
+                       same_mtime(env_stat.st_mtim, cache->env_mtime) &&
+                       same_mtime(dir_stat.st_mtim, cache->dir_mtime);
+    Config &config = ctx.config;
+    shared_ptr<TaskPack> pack;
+    if (cache_valid) {
+        config = cache->config;
+    } else if (packed) {
+        string error;
+        pack = load_pack(task_path, error);
+        if (!pack) {
+            err << task_path << ": " << error << endl;
+            cancel_compile(student_job);
+            return 1;
+        }
+        config = pack_config(*pack, err);
+    } else {
+        config = read_config(config_file, err);
+    }
+    
+    // 与学生代码同时编译题目程序 (checker.cpp、interactor.cpp、manager.cpp，使用testlib.h)，诊断信息分开收集
+    // 常驻模式下源文件未修改时直接使用上次编译的结果
+    struct TaskBuild {
+        string source;
+        string *exe;
+        CachedProgram *cached;
+        const char *description;
+        bool plugin;                // 编译为checker插件 (共享库)
+        bool worker;                // 加上常驻checker进程的外壳
+        struct stat source_stat;
+        CompileJob job;
+    };
+    vector<TaskBuild> builds;
+    auto add_build = [&builds](const string &source, string *exe, CachedProgram *cached,
+                               const char *description, bool plugin, bool worker) {
+        TaskBuild build = TaskBuild();
+        build.source = source;
+        build.exe = exe;
+        build.cached = cached;
+        build.description = description;
+        build.plugin = plugin;
+        build.worker = worker;
+        builds.push_back(build);
+    };
+    if (config.checker_plugin) {
+        ctx.checker_exe += ".so";
+        add_build(task_dir + "/checker.cpp", &ctx.checker_exe,
+                  cache ? &cache->checker_plugin : nullptr, "checker插件代码 (checker.cpp)", true, false);
+    } else if (config.special_judge && config.checker_workers > 0) {
+        add_build(task_dir + "/checker.cpp", &ctx.checker_exe,
+                  cache ? &cache->checker_worker : nullptr, "Special Judge代码 (checker.cpp)", false, true);
+    } else if (config.special_judge) {
+        add_build(task_dir + "/checker.cpp", &ctx.checker_exe,
+                  cache ? &cache->checker : nullptr, "Special Judge代码 (checker.cpp)", false, false);
+    }
+    if (config.communication) {
+        add_build(task_dir + "/manager.cpp", &ctx.manager_exe,
+                  cache ? &cache->manager : nullptr, "通信题管理器代码 (manager.cpp)", false, false);
+    } else if (config.interactive) {
+        add_build(task_dir + "/interactor.cpp", &ctx.interactor_exe,
+                  cache ? &cache->interactor : nullptr, "交互器代码 (interactor.cpp)", false, false);
+    }
+    for (size_t i = 0; i < builds.size(); ) {
+        TaskBuild &build = builds[i];
+        bool exists = stat(build.source.c_str(), &build.source_stat) == 0;
+        if (build.cached != nullptr) {
+            CachedProgram &cached = *build.cached;
+            if (cached.built && exists && same_mtime(build.source_stat.st_mtim, cached.mtime)) {
+                *build.exe = cached.exe;
+                builds.erase(builds.begin() + i);
+                continue;
+            }
+            cached.built = false;
+            cached.exe = cached.prefix + "_" + to_string(++cached.generation);
+            *build.exe = cached.exe;
+        }
+        build.job = build.plugin ? start_compile(build.source, *build.exe, options, false, true)
+                                 : start_compile(build.source, *build.exe, options, true, false, build.worker);
+        i++;
+    }
+    
+    if (!builds.empty()) {
+        if (student_failed()) {
+            for (auto &build : builds) {
+                cancel_compile(build.job);
+            }
+            return 0;
+        }
+        for (size_t i = 0; i < builds.size(); i++) {
+            if (!finish_compile(builds[i].job, options, out)) {
+                err << builds[i].description << " 编译失败" << endl;
+                for (size_t j = i + 1; j < builds.size(); j++) {
+                    cancel_compile(builds[j].job);
+                }
+                return 1;
+            }
+            if (builds[i].cached != nullptr) {
+                builds[i].cached->built = true;
+                builds[i].cached->mtime = builds[i].source_stat.st_mtim;
+            }
+        }
+    }
+    if (config.checker_plugin) {
+        // 隔离运行时插件只在辅助进程中加载，评测进程不执行插件的任何代码
+        if (!config.checker_isolation) {
+            ctx.checker_plugin = make_shared<CheckerPlugin>();
+            string error;
+            if (!ctx.checker_plugin->load(ctx.checker_exe, error)) {
+                err << "checker插件加载失败: " << error << endl;
+                return 1;
+            }
+        }
+    } else if (config.special_judge && config.checker_workers > 0) {
+        // 常驻模式下进程池随题目缓存，checker没有重新编译时下一次评测继续使用
+        if (cache != nullptr && cache->checker_workers &&
+            cache->checker_workers->matches(ctx.checker_exe, config.checker_workers)) {
+            ctx.checker_workers = cache->checker_workers;
+        } else {
+            ctx.checker_workers = make_shared<CheckerWorkers>(ctx.checker_exe, config.checker_workers);
+            if (cache != nullptr) {
+                cache->checker_workers = ctx.checker_workers;
+            }
+        }
+    }
+    
+    // 获取测试点
+    vector<TestPoint> test_points = cache_valid ? cache->test_points
+                                  : pack ? pack_test_points(pack, config.point_ratio)
+                                         : get_test_points(task_dir, config.point_ratio, err);
+    if (cache != nullptr && !cache_valid) {
+        // 先取mtime再读取内容，读取过程中的修改会在下次评测时被发现
+        cache->loaded = stat(config_file.c_str(), &env_stat) == 0 &&
+                        stat(task_dir.c_str(), &dir_stat) == 0;
+        cache->env_mtime = env_stat.st_mtim;
+        cache->dir_mtime = dir_stat.st_mtim;
+        cache->config = config;
+        cache->test_points = test_points;
+        cache->answers.clear();
+    }
+    
+    // 常驻模式下复用标准输出的映射，文件被修改时重新映射
+    if (cache != nullptr && !config.special_judge && !config.interactive && !config.communication &&
+        !options.stream) {
+        for (auto &point : test_points) {
+            struct stat st;
+            if (point.pack || decompressor_for(point.output_file) != nullptr ||
+                stat(point.output_file.c_str(), &st) != 0) continue;
+            CachedAnswer &entry = cache->answers[point.output_file];
+            if (!entry.file || entry.dev != st.st_dev || entry.ino != st.st_ino ||
+                !same_mtime(entry.mtime, st.st_mtim) || entry.size != st.st_size) {
+                entry.file = make_shared<MappedFile>();
+                if (!entry.file->open(point.output_file)) {
+                    entry.file.reset();
+                    continue;
+                }
+                entry.dev = st.st_dev;
+                entry.ino = st.st_ino;
+                entry.mtime = st.st_mtim;
+                entry.size = st.st_size;
+            }
+            point.answer = entry.file;
+        }
+    }
+    if (cache_lock.owns_lock()) {
+        cache_lock.unlock();
+    }
+    
+    if (!student_compiled && student_failed()) {
+        return 0;
+    }
+    
+    if (test_points.empty()) {
+        err << "未找到测试点" << endl;
+        err << "请确保测试文件夹中包含格式为 *.in 和 *.out 的文件 (可以用zstd或gzip压缩为 .zst/.gz)，且文件名中包含数字（如 game001.in, game001.out）" << endl;
+        return 1;
+    }
+    
+    // zygote模式只用于普通评测，交互题和通信题的学生程序与其他进程配对启动
+    if (options.zygote && !config.interactive && !config.communication) {
+        ctx.launcher_exe = build_zygote_launcher(work.path(), options);
+        if (ctx.launcher_exe.empty()) {
+            err << "警告: zygote启动器编译失败，逐个启动学生程序" << endl;
+        }
+    }
+    
+    // 资源限制后端：cgroup v2不可用时退回rlimit
+    RunLimits &limits = ctx.limits;
+    limits.time_limit = config.time_limit;
+    limits.wall_time_limit = config.wall_time_limit;
+    limits.memory_limit = config.memory_limit;
+    limits.process_limit = config.process_limit;
+    limits.output_limit = config.output_limit;
+    if (!options.cgroup_dir.empty()) {
+        if (cgroup_prepare(options.cgroup_dir)) {
+            limits.cgroup_dir = options.cgroup_dir;
+        } else {
+            err << "警告: cgroup v2目录不可用 (" << options.cgroup_dir << ")，使用rlimit限制资源" << endl;
+        }
+    }
+    
+    // 结果缓存只用于普通题目 (交互题和通信题的结果还取决于交互器或管理器)
+    if (config.result_cache && !config.interactive && !config.communication) {
+        Sha256 student_hash;
+        if (options.cache_dir.empty()) {
+            err << "警告: 结果缓存需要编译缓存目录 (--cache-dir)，本次不使用结果缓存" << endl;
+        } else if (hash_file(student_hash, ctx.student_exe) && !judge_version().empty()) {
+            // cgroup和rlimit统计的内存不同，也计入键中
+            ctx.result_key = judge_version() + " " + student_hash.hex_digest() + " " +
+                             to_string(limits.time_limit) + " " + to_string(limits.wall_time_limit) + " " +
+                             to_string(limits.memory_limit) + " " + to_string(limits.process_limit) + " " +
+                             to_string(limits.output_limit) + " " + (limits.cgroup_dir.empty() ? "rlimit" : "cgroup");
+        }
+    }
+    
+    // 子任务分组：第i个数字是第i个测试点所属的子任务，同组测试点全部通过才得分
+    bool use_subtask = config.enable_subtask && !config.subtask_groups.empty();
+    if (use_subtask) {
+        for (size_t i = 0; i < test_points.size() && i < config.subtask_groups.size(); i++) {
+            test_points[i].subtask = config.subtask_groups[i];
+        }
+    }
+    
+    // 运行所有测试点
+    double total_score = 0;
+    int total_ratio = 0;
+    for (auto &ratio : config.point_ratio) {
+        total_ratio += ratio;
+    }
+    if (total_ratio == 0) total_ratio = test_points.size();
+    
+    out << "开始评测..." << endl;
+    out << "测试点数量: " << test_points.size() << endl;
+    out << "时间限制: " << config.time_limit << "ms (墙钟 " << config.wall_time_limit << "ms)" << endl;
+    out << "内存限制: " << config.memory_limit << "MB" << endl;
+    if (config.communication) {
+        out << "评测方式: 通信题 (" << max(1, config.communication_processes) << "个实例，使用testlib.h)" << endl;
+    } else if (config.interactive) {
+        out << "评测方式: 交互题 (使用testlib.h)" << endl;
+    } else if (config.checker_plugin) {
+        out << "评测方式: Special Judge (checker插件" << (config.checker_isolation ? "，隔离运行" : "") << ")" << endl;
+    } else if (config.special_judge && config.checker_workers > 0) {
+        out << "评测方式: Special Judge (使用testlib.h，" << config.checker_workers << "个常驻checker进程)" << endl;
+    } else if (config.special_judge) {
+        out << "评测方式: Special Judge (使用testlib.h)" << endl;
+    } else if (config.comparator != TEXT_COMPARE) {
+        static const char *names[] = {"文本", "单词", "实数", "忽略大小写", "行集合"};
+        out << "评测方式: 内置比较 (" << names[config.comparator] << ")";
+        if (config.comparator == FLOAT_COMPARE) {
+            out << "，绝对误差 " << config.absolute_error << "，相对误差 " << config.relative_error;
+        }
+        out << endl;
+    } else if (options.stream) {
+        out << "评测方式: 文本比对 (流式)" << endl;
+    } else {
+        out << "评测方式: 文本比对" << endl;
+    }
+    out << endl;
+    
+    // 工作线程按order的顺序领取测试点，主线程按测试点编号顺序输出结果
+    // 子任务中有测试点失败后，同组还没开始的测试点直接跳过
+    size_t worker_count = min((size_t)options.jobs, test_points.size());
+    // 只有一个工作线程时顺序不影响总用时，保持编号顺序，结果可以边评测边输出，也不需要运行时间记录
+    string history_file = (worker_count > 1) ? history_path(options.cache_dir, task_path) : "";
+    vector<size_t> order(test_points.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    if (!history_file.empty()) {
+        order = schedule_points(test_points, read_history(history_file));
+    }
+    vector<char> finished(test_points.size(), 0);
+    map<int, bool> failed_subtasks;
+    atomic<size_t> next_point(0);
+    mutex finished_mutex;
+    condition_variable finished_cv;
+    
+    // 交互题绑定CPU时每个工作线程的两个进程占用允许使用的CPU中的一个
+    vector<int> cpus;
+    cpu_set_t allowed;
+    if (config.interactive && options.pin_cpu && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed)) cpus.push_back(c);
+        }
+    }
+    
+    vector<thread> workers;
+    for (size_t w = 0; w < worker_count; w++) {
+        string worker_dir = work.path() + "/worker_" + to_string(w);
+        mkdir(worker_dir.c_str(), 0755);
+        int cpu = cpus.empty() ? -1 : cpus[w % cpus.size()];
+        workers.emplace_back([&, worker_dir, cpu]() {
+            // zygote模式下第一个启动器在工作线程开始时准备，之后每次运行时准备下一个
+            Zygote zygote;
+            bool use_zygote = !ctx.launcher_exe.empty();
+            if (use_zygote) {
+                zygote.prepare(ctx.launcher_exe, ctx.student_exe, ctx.limits, worker_dir);
+            }
+            size_t next;
+            while ((next = next_point++) < test_points.size()) {
+                size_t i = order[next];
+                TestPoint &point = test_points[i];
+                bool skip = false;
+                if (point.subtask != 0) {
+                    lock_guard<mutex> lock(finished_mutex);
+                    skip = failed_subtasks[point.subtask];
+                }
+                if (skip) {
+                    point.result = SKIPPED;
+                } else {
+                    judge_point(ctx, point, i, worker_dir, cpu, use_zygote ? &zygote : nullptr);
+                }
+                lock_guard<mutex> lock(finished_mutex);
+                if (point.subtask != 0 && point.result != AC) {
+                    failed_subtasks[point.subtask] = true;
+                }
+                finished[i] = 1;
+                finished_cv.notify_all();
+            }
+        });
+    }
+    
+    for (size_t i = 0; i < test_points.size(); i++) {
+        {
+            unique_lock<mutex> lock(finished_mutex);
+            finished_cv.wait(lock, [&]() { return finished[i] != 0; });
+        }
+        TestPoint &point = test_points[i];
+        
+        string point_name = (point.number != -1) ? to_string(point.number) : to_string(i + 1);
+        
+        // 输出测试点结果
+        out << "测试点 " << point_name << ": " << result_to_string(point.result);
+        if (point.result == AC) {
+            out << " (" << point.time_used << "ms, " 
+                << point.memory_used << "KB)";
+            if (point.subtask == 0) {
+                total_score += config.total_score * point.point_ratio / (double)total_ratio;
+            }
+        } else if (point.result == TLE) {
+            out << " (CPU " << point.time_used << "ms, 墙钟 "
+                << point.wall_time_used << "ms)";
+        } else if (point.result == WA && point.diff.line > 0) {
+            out << " (第" << point.diff.line << "行第" << point.diff.column
+                << "列, 偏移" << point.diff.offset << ")";
+        }
+        if (point.cached_run) {
+            out << " [缓存]";
+        }
+        out << endl;
+    }
+    
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (!ctx.result_key.empty()) {
+        compile_cache_evict(options.cache_dir, options.cache_size_mb * 1024 * 1024);
+    }
+    if (!history_file.empty()) {
+        update_history(history_file, test_points);
+    }
+    
+    // 子任务得分：组内所有测试点分数比例之和，取组内最低结果
+    if (use_subtask) {
+        map<int, int> subtask_ratio;
+        for (const auto &point : test_points) {
+            if (point.subtask != 0) {
+                subtask_ratio[point.subtask] += point.point_ratio;
+            }
+        }
+        out << endl;
+        for (const auto &group : subtask_ratio) {
+            double score = config.total_score * group.second / (double)total_ratio;
+            bool passed = !failed_subtasks[group.first];
+            out << "子任务 " << group.first << ": " << (passed ? "通过" : "未通过");
+            if (passed) {
+                out << " (" << score << "分)";
+                total_score += score;
+            }
+            out << endl;
+        }
+    }
+    
+    out << endl;
+    out << "评测结束" << endl;
+    out << "总分: " << (int)total_score << "/" << config.total_score << endl;
     
     return 0;
-}
\ No newline at end of file
+}
+
+// 常驻模式的输出流：每一行加上通道号后写入socket
+// 通道1为标准输出，2为标准错误，0为退出码，客户端据此还原单次运行的输出
+// 主线程输出结果时工作线程可能同时报告诊断信息，同一连接的各通道共用send_lock，整行发送
+class SocketLineBuf : public streambuf {
+public:
+    SocketLineBuf(int fd, char channel, mutex &send_lock) : fd(fd), channel(channel), send_lock(send_lock) {}
+    
+protected:
+    int overflow(int c) override {
+        if (c == EOF) {
+            return 0;
+        }
+        line += (char)c;
+        if (c == '\n') {
+            send_line();
+        }
+        return c;
+    }
+    
+private:
+    void send_line() {
+        string frame = string(1, channel) + " " + line;
+        line.clear();
+        lock_guard<mutex> lock(send_lock);
+        size_t sent = 0;
+        while (sent < frame.size()) {
+            ssize_t n = send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                return;  // 客户端已断开，继续评测但丢弃输出
+            }
+            sent += n;
+        }
+    }
+    
+    int fd;
+    char channel;
+    mutex &send_lock;
+    string line;
+};
+
+// 从socket读取一行 (不含换行符)，连接关闭时返回false
+bool read_socket_line(int fd, string &buffer, string &line) {
+    while (true) {
+        size_t pos = buffer.find('\n');
+        if (pos != string::npos) {
+            line = buffer.substr(0, pos);
+            buffer.erase(0, pos + 1);
+            return true;
+        }
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+}
+
+// 绑定Unix socket地址
+bool make_socket_address(const string &path, sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+// 常驻模式的共享状态，由serve和各连接线程共同持有，最后一个使用者结束时删除checker目录
+struct ServeState {
+    explicit ServeState(const Options &options) : base_options(options), checker_dir(options.work_root) {}
+    
+    const Options base_options;
+    WorkDir checker_dir;            // 每个题目的checker编译到这个目录下
+    map<string, shared_ptr<TaskCache>> tasks;
+    mutex tasks_mutex;
+    unsigned long request_count = 0;
+};
+
+// 处理常驻模式的一个连接
+void serve_connection(int client_fd, shared_ptr<ServeState> state) {
+    const size_t max_cached_tasks = 256;
+    const Options &base_options = state->base_options;
+    const string &checker_dir = state->checker_dir.path();
+    map<string, shared_ptr<TaskCache>> &tasks = state->tasks;
+    unsigned long &request_count = state->request_count;
+    
+    vector<string> request;
+    string buffer, line;
+    while (read_socket_line(client_fd, buffer, line) && !line.empty()) {
+        request.push_back(line);
+    }
+    
+    mutex send_lock;
+    SocketLineBuf out_buf(client_fd, '1', send_lock), err_buf(client_fd, '2', send_lock);
+    ostream out(&out_buf), err(&err_buf);
+    Options options = base_options;
+    options.serve_socket.clear();
+    vector<string> args = parse_options(request, options);
+    if (options.cache_dir != base_options.cache_dir) {
+        prepare_cache_dir(options, err);
+    }
+    if (options.input_cache_mb != base_options.input_cache_mb) {
+        err << "警告: 输入缓存由评测服务的所有请求共用，预算只能在启动服务时指定，忽略本次请求的 --input-cache" << endl;
+        options.input_cache_mb = base_options.input_cache_mb;
+    }
+    int code = 1;
+    if (args.size() < 2) {
+        err << "请求缺少 student.cpp 或 task_folder" << endl;
+    } else {
+        shared_ptr<TaskCache> cache;
+        {
+            lock_guard<mutex> lock(state->tasks_mutex);
+            // 超出缓存上限时淘汰最久未使用的题目 (正在使用它的评测持有shared_ptr，不受影响)
+            if (tasks.find(args[1]) == tasks.end() && tasks.size() >= max_cached_tasks) {
+                auto oldest = tasks.begin();
+                for (auto it = tasks.begin(); it != tasks.end(); ++it) {
+                    if (it->second->last_used < oldest->second->last_used) oldest = it;
+                }
+                tasks.erase(oldest);
+            }
+            shared_ptr<TaskCache> &slot = tasks[args[1]];
+            if (!slot) {
+                slot = make_shared<TaskCache>();
+                slot->checker.prefix = checker_dir + "/checker_" + to_string(request_count);
+                slot->checker_plugin.prefix = checker_dir + "/checker_plugin_" + to_string(request_count);
+                slot->checker_worker.prefix = checker_dir + "/checker_worker_" + to_string(request_count);
+                slot->interactor.prefix = checker_dir + "/interactor_" + to_string(request_count);
+                slot->manager.prefix = checker_dir + "/manager_" + to_string(request_count);
+            }
+            slot->last_used = ++request_count;
+            cache = slot;
+        }
+        code = judge_submission(args[0], args[1], options, out, err, cache.get());
+    }
+    out << flush;
+    err << flush;
+    
+    SocketLineBuf code_buf(client_fd, '0', send_lock);
+    ostream code_out(&code_buf);
+    code_out << code << endl;
+    close(client_fd);
+}
+
+// 常驻模式：在Unix socket上接收提交，逐个测试点把结果流式返回
+// 请求格式：每行一个参数 (选项和 student.cpp task_folder 的绝对路径)，以空行结束
+// 每个连接由单独的线程处理，各自使用私有工作目录；
+// 题目的配置、测试点列表、checker和标准输出映射保存在内存中，在多次请求之间复用
+int serve(const Options &base_options) {
+    sockaddr_un addr;
+    if (!make_socket_address(base_options.serve_socket, addr)) {
+        cerr << "socket路径过长: " << base_options.serve_socket << endl;
+        return 1;
+    }
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(addr.sun_path);
+    if (listen_fd < 0 || ::bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 64) != 0) {
+        cerr << "无法监听 " << base_options.serve_socket << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    
+    // 连接线程不被等待，它们各自持有共享状态的引用
+    shared_ptr<ServeState> state = make_shared<ServeState>(base_options);
+    if (!state->checker_dir.valid()) {
+        cerr << "无法在 " << base_options.work_root << " 下创建工作目录" << endl;
+        return 1;
+    }
+    cerr << "评测服务已启动: " << base_options.serve_socket << endl;
+    
+    while (true) {
+        int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            cerr << "accept失败: " << strerror(errno) << endl;
+            break;
+        }
+        thread(serve_connection, client_fd, state).detach();
+    }
+    
+    close(listen_fd);
+    return 1;
+}
+
+// 常驻模式的客户端：把参数发给评测服务并原样输出结果，退出码与单次运行相同
+int run_client(const string &socket_path, const vector<string> &argv) {
+    Options ignored;
+    vector<string> option_args;
+    vector<string> args = parse_options(argv, ignored, &option_args);
+    if (args.size() < 2) {
+        cerr << "用法: judge --client SOCKET [选项] student.cpp task_folder" << endl;
+        return 1;
+    }
+    
+    // 服务进程的工作目录不同，路径一律转为绝对路径
+    vector<string> request = option_args;
+    for (size_t i = 0; i < 2; i++) {
+        char resolved[PATH_MAX];
+        request.push_back(realpath(args[i].c_str(), resolved) != nullptr ? string(resolved) : args[i]);
+    }
+    
+    sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (!make_socket_address(socket_path, addr) || fd < 0 ||
+        connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        cerr << "无法连接评测服务 " << socket_path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    string message;
+    for (const auto &arg : request) {
+        message += arg + "\n";
+    }
+    message += "\n";
+    if (send(fd, message.data(), message.size(), MSG_NOSIGNAL) != (ssize_t)message.size()) {
+        cerr << "发送请求失败" << endl;
+        close(fd);
+        return 1;
+    }
+    
+    string buffer, line;
+    int code = 1;
+    while (read_socket_line(fd, buffer, line)) {
+        if (line.size() < 2) continue;
+        string text = line.substr(2);
+        if (line[0] == '1') {
+            cout << text << endl;
+        } else if (line[0] == '2') {
+            cerr << text << endl;
+        } else if (line[0] == '0') {
+            code = atoi(text.c_str());
+        }
+    }
+    close(fd);
+    return code;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 4 && string(argv[1]) == "--bench-compare") {
+        return bench_compare(argv[2], argv[3], argc >= 5 ? atoi(argv[4]) : 10);
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-spawn") {
+        return bench_spawn(argc >= 3 ? atoi(argv[2]) : 1000, argc >= 4 ? atol(argv[3]) : 0);
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-pingpong") {
+        return bench_pingpong(argc >= 3 ? atol(argv[2]) : 100000);
+    }
+    if (argc >= 3 && string(argv[1]) == "--client") {
+        return run_client(argv[2], vector<string>(argv + 3, argv + argc));
+    }
+    if (argc == 6 && string(argv[1]) == "--plugin-check") {
+        return plugin_check_main(argv[2], vector<string>(argv + 3, argv + 6));
+    }
+    if (argc >= 3 && string(argv[1]) == "pack") {
+        return pack_task(argv[2], argc >= 4 ? argv[3] : string(argv[2]) + "/task.pack");
+    }
+    
+    // 在映射任何测试数据之前启动，之后的被评测程序都由这个小进程启动
+    SpawnHelper::instance().start();
+    Options options;
+    vector<string> args = parse_options(vector<string>(argv + 1, argv + argc), options);
+    prepare_cache_dir(options, cerr);
+    // 输入缓存是整个进程共用的，预算在启动时确定
+    InputCache::instance().set_budget(options.input_cache_mb * 1024 * 1024);
+    if (!options.serve_socket.empty()) {
+        return serve(options);
+    }
+    if (args.size() < 2) {
+        cerr << "用法: " << argv[0] << " [选项] student.cpp task_folder" << endl;
+        cerr << "示例: " << argv[0] << " -j 8 solution.cpp ./testdata" << endl;
+        cerr << "  -j N              同时评测N个测试点 (N<=0 时使用全部CPU核)" << endl;
+        cerr << "  --cgroup DIR      在委派的cgroup v2目录下为每次运行创建子cgroup限制内存和进程数" << endl;
+        cerr << "  --stream          边运行边比对输出，第一处不一致立即判WA (Special Judge时不生效)" << endl;
+        cerr << "  --cache-dir DIR   编译缓存目录 (默认$XDG_CACHE_HOME/judge或/tmp/judge_cache-UID)，--no-cache 关闭编译缓存" << endl;
+        cerr << "  --cache-size MB   编译缓存 (含结果缓存) 容量上限 (默认1024MB)，超出后淘汰最久未用的项" << endl;
+        cerr << "  --work-dir DIR    临时工作目录的位置 (默认/tmp)，--tmpfs 使用/dev/shm" << endl;
+        cerr << "  --pin-cpu         交互题的学生程序和交互器绑定到同一个CPU，减少每次往返的唤醒延迟" << endl;
+        cerr << "  --static          学生程序静态链接，exec后不需要动态加载和重定位" << endl;
+        cerr << "  --zygote          学生程序静态链接，每个工作线程预先启动下一个测试点的启动器" << endl;
+        cerr << "  --input-cache MB  输入文件读入内存缓存 (密封的memfd)，总大小不超过MB，超出后淘汰最久未用的项" << endl;
+        cerr << "                    常驻模式下由启动服务时的选项决定，请求中的 --input-cache 被忽略" << endl;
+        cerr << "  task_folder也可以是任务包，题目的checker.cpp等文件放在任务包所在的目录中" << endl;
+        cerr << "打包题目: " << argv[0] << " pack task_folder [任务包路径 (默认task_folder/task.pack)]" << endl;
+        cerr << "常驻模式: " << argv[0] << " [选项] --serve SOCKET" << endl;
+        cerr << "          " << argv[0] << " --client SOCKET [选项] student.cpp task_folder" << endl;
+        cerr << "基准测试: " << argv[0] << " --bench-compare std.out user.out [轮数]" << endl;
+        cerr << "          " << argv[0] << " --bench-pingpong [往返次数]" << endl;
+        cerr << "          " << argv[0] << " --bench-spawn [启动次数] [额外占用内存MB]" << endl;
+        return 1;
+    }
+    
+    return judge_submission(args[0], args[1], options, cout, cerr);
+}